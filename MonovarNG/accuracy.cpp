@@ -0,0 +1,96 @@
+//
+//  accuracy.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "accuracy.hpp"
+#include "vcf.hpp"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+static string siteName(const VariantCall& call) {
+    return call.chromosome + ":" + to_string(call.posID);
+}
+
+static bool printsDifferently(double a, double b) {
+    // whether a and b differ in the vcf, which prints them with 6 significant digits
+    char textA[32], textB[32];
+    snprintf(textA, sizeof(textA), "%g", a);
+    snprintf(textB, sizeof(textB), "%g", b);
+    return strcmp(textA, textB);
+}
+
+void accuracy::compareCalls(const vector<unique_ptr<VariantCall>>& reference, const vector<unique_ptr<VariantCall>>& test, string referenceName, string testName, FILE* out) {
+    // Sites are matched by position, as the two runs read the same pileup
+    unordered_map<string, const VariantCall*> testSites;
+    for (auto& call: test) testSites[siteName(*call)] = call.get();
+    
+    const int maxListed = 10; // sites listed for each kind of difference
+    long bothCalled = 0, qualPrinted = 0, cells = 0, plDiffer = 0, gqDiffer = 0, gtDiffer = 0;
+    double maxQualDiff = 0, maxQualRelative = 0, maxPLDiff = 0;
+    vector<string> onlyReference, onlyTest, qualSites;
+    for (auto& call: reference) {
+        auto match = testSites.find(siteName(*call));
+        if (match == testSites.end()) {
+            onlyReference.push_back(siteName(*call));
+            continue;
+        }
+        const VariantCall& other = *match->second;
+        testSites.erase(match);
+        bothCalled++;
+        
+        double qualDiff = fabs(call->quality - other.quality);
+        maxQualDiff = max(maxQualDiff, qualDiff);
+        if (call->quality) maxQualRelative = max(maxQualRelative, qualDiff/fabs(call->quality));
+        if (printsDifferently(call->quality, other.quality)) {
+            qualPrinted++;
+            if (qualSites.size() < maxListed) qualSites.push_back(siteName(*call) + " (" + to_string(call->quality) + " against " + to_string(other.quality) + ")");
+        }
+        
+        // PL are compared as the vcf writes them, taking the likelihoods in turn for each cell with a genotype
+        int likelihoodsIndex = 0, otherIndex = 0;
+        for (int i = 0; i < call->genotypes.size(); i++) {
+            if (call->genotypes[i] != other.genotypes[i]) gtDiffer++;
+            if (call->genotypes[i] == -1 || other.genotypes[i] == -1) {
+                if (call->genotypes[i] != -1) likelihoodsIndex++;
+                if (other.genotypes[i] != -1) otherIndex++;
+                continue;
+            }
+            double pl[3], otherPL[3];
+            int gq = VariantDocument::genotypeQualities(call->likelihoods[likelihoodsIndex++], pl);
+            int otherGQ = VariantDocument::genotypeQualities(other.likelihoods[otherIndex++], otherPL);
+            cells++;
+            if (gq != otherGQ) gqDiffer++;
+            bool differ = false;
+            for (int j = 0; j < 3; j++) {
+                maxPLDiff = max(maxPLDiff, fabs(pl[j] - otherPL[j]));
+                differ |= pl[j] != otherPL[j];
+            }
+            if (differ) plDiffer++;
+        }
+    }
+    for (auto& call: test) {
+        if (testSites.count(siteName(*call))) onlyTest.push_back(siteName(*call));
+    }
+    
+    fprintf(out, "Accuracy of %s against %s\n", testName.c_str(), referenceName.c_str());
+    fprintf(out, "Sites called by both: %ld\n", bothCalled);
+    fprintf(out, "Sites called by %s only: %zu\n", referenceName.c_str(), onlyReference.size());
+    for (int i = 0; i < onlyReference.size() && i < maxListed; i++) fprintf(out, "  %s\n", onlyReference[i].c_str());
+    fprintf(out, "Sites called by %s only: %zu\n", testName.c_str(), onlyTest.size());
+    for (int i = 0; i < onlyTest.size() && i < maxListed; i++) fprintf(out, "  %s\n", onlyTest[i].c_str());
+    fprintf(out, "QUAL: largest difference %g (relative %g), printed differently at %ld sites\n", maxQualDiff, maxQualRelative, qualPrinted);
+    for (string& site: qualSites) fprintf(out, "  %s\n", site.c_str());
+    fprintf(out, "PL: %ld of %ld cells differ, by at most %g\n", plDiffer, cells, maxPLDiff);
+    fprintf(out, "GQ: %ld of %ld cells differ\n", gqDiffer, cells);
+    fprintf(out, "GT: %ld cells differ\n", gtDiffer);
+}
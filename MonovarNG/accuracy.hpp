@@ -0,0 +1,24 @@
+//
+//  accuracy.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef accuracy_hpp
+#define accuracy_hpp
+
+#include "vcf.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+using namespace std;
+
+namespace accuracy {
+    void compareCalls(const vector<unique_ptr<VariantCall>>& reference, const vector<unique_ptr<VariantCall>>& test, string referenceName, string testName, FILE* out); // writes a report of how far the QUAL, PL, GQ and GT of test are from reference to out
+}
+
+#endif /* accuracy_hpp */
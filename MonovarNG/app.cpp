@@ -17,19 +17,29 @@
 #include <iostream>
 #include <array>
 #include <mutex>
+#include <future>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
 
 using namespace std;
 using namespace utility;
 
-App::App(Config& config, vector<string>& bamIDs, vector<string>& pileupRows) : mutationThreshold(config.mutationThreshold), pFalsePositive(config.pFalsePositive), pDropout(config.pDropout), numThreads(config.numThreads), useConsensusFilter(config.useConsensusFilter), pileup(pileupRows), combi(Combination(2*bamIDs.size())), phred(Phred()), output(VCFDocument(config.outputFilename)) {
+App::App(Config& config, vector<string>& bamIDs, RowSource& rows) : mutationThreshold(config.mutationThreshold), pFalsePositive(config.pFalsePositive), pDropout(config.pDropout), numThreads(config.numThreads), useConsensusFilter(config.useConsensusFilter), rows(rows), combi(Combination(2*bamIDs.size())), phred(Phred()), output(openOutput(config)), results(config.reorderSize + config.numThreads * rows.orderSpan()) {
     numCells = bamIDs.size();
+    if (config.numericEngine != "wrdouble" && config.numericEngine != "log" && config.numericEngine != "auto") throw invalid_argument("Unknown numeric engine " + config.numericEngine + ", expected wrdouble, log or auto");
+    logSpace = config.numericEngine == "log";
+    adaptivePrecision = config.numericEngine == "auto";
     
     // Write some VCF stuff
-    output.writeDefHeader();
+    output->writeDefHeader();
     vector<string> bamFilenames = getBamFilenames(config.bamfileNames);
-    output.writeHeaderInfo(config.referenceFilename, bamFilenames);
-    
-    numPos = pileup.size();
+    output->writeHeaderInfo(config.referenceFilename, bamFilenames);
+    if (config.matrixPrefix.size()) matrix.reset(new GenotypeMatrixWriter(config.matrixPrefix, bamFilenames));
+    if (config.blockFilename.size()) {
+        blocks.reset(new ReferenceBlockWriter(config.blockFilename));
+        blocks->writeHeader(config.referenceFilename);
+    }
     
     // Set combi object for each pileup
 //    for (auto& row: positions) {
@@ -37,14 +47,34 @@ App::App(Config& config, vector<string>& bamIDs, vector<string>& pileupRows) : m
 //    }
 }
 
-void App::processRow(int rowN) {
-    // processes row of data
+RowResult App::processRow(Row& row) {
+    // processes row of data, parsing it unless the source already built the site
+    if (row.site) return processPileup(*row.site, row.index);
+    RowResult result;
+    if (!row.text.size()) return result; // only keeps its place in the order
+    
+    // Most rows fail the prefilter, which only needs the depths and reference base, so those are read off the raw row first
+    if (prefilterRow(numCells, row.text, blocks ? &result.reference : nullptr)) {
+        if ((row.index+1) % 50000 == 0) fprintf(stderr, "Processed row %ld\n", row.index+1);
+        return result;
+    }
+    Pileup position = getPileup(numCells, row.text);
+    return processPileup(position, row.index);
+}
+
+RowResult App::processPileup(Pileup& position, long rowN) {
+    // processes a parsed site
 //    cout << "row " << rowN << endl;
-    Pileup position = getPileup(numCells, pileup[rowN]);
     position.setObjs(&combi, &phred);
+    position.logSpace = logSpace;
+    position.adaptivePrecision = adaptivePrecision;
 //    cout << "set objects" << endl;
+    RowResult result;
+    ReferenceSite& reference = result.reference;
     
-    int totalDepth = position.totalDepth(), refDepth = position.refDepth(); // total no. of reads / no. matching reference base
+    // Sites from a site cache already passed the prefilter and were prepared when the cache was written
+    if (!position.prepared) position.countDepths();
+    int totalDepth = position.rawTotalDepth, refDepth = position.rawRefDepth; // total no. of reads / no. matching reference base
     
     int altCount = totalDepth - refDepth; // no. of alternate reads
     
@@ -52,27 +82,35 @@ void App::processRow(int rowN) {
     if (totalDepth == 0) altFreq = 0;
     else altFreq = (double) altCount / totalDepth;
     
-    // Prefilter
-    int prefilter = 0;
-    if (totalDepth == refDepth) prefilter = 1; // no reads supporting alternate allele, so no operations needed
-    else if (totalDepth > 30 && (altCount <= 2 || altFreq <= 0.001)) prefilter = 2; // prefiltered due to unlikely mutation
-    else if (string("ATGC").find(position.refBase) == string::npos) prefilter = 3; // bad reference
-    else if (totalDepth <= 10) prefilter = 4; // insufficient data
-    if (prefilter) {
-        //            if (prefilter == 3) printf("%d Prefiltered due to %d\n", rowN+1, prefilter);
-        if ((rowN+1) % 50000 == 0) printf("Processed row %d\n", rowN+1);
-        return;
+    if (blocks) {
+        // Filled in now, as prepare turns the reference base into a number
+        reference.pos = position.seqPos;
+        reference.ref = position.prepared ? "ACTG"[position.refBase] : position.refBase;
+        reference.depth = totalDepth;
     }
-//    cout << "after filtering" << endl;
-    // Parse and filter reads
-    position.sanitizeBases();
-    position.filterCellsWithRead();
     
-    // Another filtration, in case all reads are erased
-    if (!position.numCells) return;
-    
-    // Find and set alternate base at positon. If alt base cannot be set, return
-    if (!position.setAltBase()) return;
+    if (!position.prepared) {
+        // Prefilter
+        int prefilter = prefilterSite(totalDepth, refDepth, position.refBase);
+        if (prefilter) {
+            //            if (prefilter == 3) printf("%d Prefiltered due to %d\n", rowN+1, prefilter);
+            if ((rowN+1) % 50000 == 0) fprintf(stderr, "Processed row %ld\n", rowN+1);
+            if (blocks) {
+                reference.seqID = position.seqID;
+                reference.filter = prefilter;
+            }
+            return result;
+        }
+//        cout << "after filtering" << endl;
+        // Parse and filter reads, and set the alternate base. Returns false if all reads are erased or no alt base can be set
+        if (!position.prepare()) {
+            if (blocks) {
+                reference.seqID = position.seqID;
+                reference.filter = 5;
+            }
+            return result;
+        }
+    }
     
     // Compute quality scores
     position.computeQualities();
@@ -86,6 +124,7 @@ void App::processRow(int rowN) {
     
     // Compute probability of zero mutations given data
     wrdouble zeroVarProb = position.computeZeroVarProb(genotypePriors, pDropout);
+    unique_ptr<VariantCall>& call = result.call;
     if (zeroVarProb < 0.05) {
         //            cout << position.seqID << " " << position.seqPos << " " << zeroVarProb << endl;
         //            position.print("", true);
@@ -98,18 +137,73 @@ void App::processRow(int rowN) {
         vector<pair<int, int>> cellDepths = position.cellDepths();
         double psarr = position.psarr(cellDepths);
         
-        outputMutex.lock();
-        output.writeRow(position.seqID, position.seqPos, position.refBase, position.altBase, quality, position.computeWilcoxon(), qualityByDepth, strandBias, psarr, genotypes, position.totalDepth(), cellDepths, position.likelihoodsGlob);
-        outputMutex.unlock();
+        call.reset(new VariantCall{position.seqID, position.seqPos, position.refBase, position.altBase, quality, position.computeWilcoxon(), qualityByDepth, strandBias, psarr, move(genotypes), position.totalDepth(), move(cellDepths), move(position.likelihoodsGlob)});
+        output->formatRow(*call); // on this worker, so the writer only copies text
+    } else if (blocks) {
+        // Confidence that the site is not variant, as phred of the probability that it is
+        double pVariant = 1 - double(zeroVarProb);
+        reference.seqID = position.seqID;
+        reference.filter = 0;
+        reference.confidence = pVariant > 0 ? min(99, int(round(-10*log10(pVariant)))) : 99;
     }
     
-    if ((rowN+1) % 50000 == 0) printf("Processed row %d\n", rowN+1);
+    if ((rowN+1) % 50000 == 0) fprintf(stderr, "Processed row %ld\n", rowN+1);
+    return result;
+}
+
+void App::processRows() {
+    // Worker loop, processes rows until the source is exhausted. Results go to the reorder buffer, so workers never wait for the file
+    try {
+        Row row;
+        while (rows.next(row)) {
+            if (!results.submit(row.order, processRow(row))) return; // another thread failed
+        }
+    } catch (...) {
+        results.abort(); // releases the other threads, which would otherwise wait for this row
+        throw;
+    }
+}
+
+void App::writeResults() {
+    // Writer loop, writes calls in input order
+    try {
+        RowResult result;
+        while (results.pop(result)) {
+            if (result.call) {
+                output->writeRow(*result.call);
+                if (matrix) matrix->addSite(result.call->chromosome, result.call->posID, result.call->ref, result.call->alt, result.call->genotypes);
+                if (keptCalls) keptCalls->push_back(move(result.call));
+            } else if (blocks && result.reference.seqID.size()) blocks->add(result.reference);
+        }
+    } catch (...) {
+        results.abort();
+        throw;
+    }
+}
+
+void App::keepCalls(vector<unique_ptr<VariantCall>>* calls) {
+    keptCalls = calls;
 }
 
 void App::runAlgo() {
-    ThreadPool pool(numThreads);
-    for (int rowN = 0; rowN < numPos; rowN++) {
-        if (numThreads > 1) pool.enqueue(&App::processRow, this, rowN);
-        else processRow(rowN); // single threaded
+    // Workers call rows while a single writer writes the calls in input order
+    future<void> writer = async(launch::async, &App::writeResults, this);
+    try {
+        if (numThreads > 1) {
+            // Each worker pulls rows from the source, so reading overlaps with computation
+            ThreadPool pool(numThreads);
+            vector<future<void>> workers;
+            for (int i = 0; i < numThreads; i++) workers.push_back(pool.enqueue(&App::processRows, this));
+            for (auto& worker: workers) worker.get(); // rethrows errors from workers
+        } else processRows(); // single threaded
+    } catch (...) {
+        results.abort();
+        writer.wait();
+        throw;
     }
+    results.close();
+    writer.get(); // rethrows errors from writing
+    output->close();
+    if (blocks) blocks->close();
+    if (matrix) matrix->close();
 }
@@ -14,6 +14,10 @@
 #include "pileup.hpp"
 #include "utility.hpp"
 #include "combination.hpp"
+#include "row_source.hpp"
+#include "reorder_buffer.hpp"
+#include "reference_blocks.hpp"
+#include "genotype_matrix.hpp"
 
 #include <stdio.h>
 #include <mutex>
@@ -21,6 +25,12 @@
 using namespace std;
 using namespace utility;
 
+struct RowResult {
+    // What a row produced: a call, a non-variant site for the reference blocks, or neither
+    unique_ptr<VariantCall> call; // null where nothing is called
+    ReferenceSite reference; // filled in only when reference blocks are written and the site is not called
+};
+
 class App {
     // Main application, controls the algorithm flow
     
@@ -31,24 +41,33 @@ class App {
     int numThreads; // number of threads for multiprocessing
     
     bool useConsensusFilter; // whether to use Consensus Filter (CF) 
+    bool logSpace; // whether sites are computed in log space rather than with wrdouble
+    bool adaptivePrecision; // whether sites are computed in plain doubles where they can not underflow, and with wrdouble elsewhere
     
     int numCells; // number of cells processed
-    int numPos; // number of positions being processed
     
-    VCFDocument output;
-    mutex outputMutex;
+    unique_ptr<VariantDocument> output; // vcf or bcf, depending on the output filename
+    unique_ptr<ReferenceBlockWriter> blocks; // reference blocks of the sites not called, null unless asked for
+    unique_ptr<GenotypeMatrixWriter> matrix; // bit-packed genotypes of the called sites, null unless asked for
+    ReorderBuffer<RowResult> results; // results of each row, put back in input order for the writer thread
+    vector<unique_ptr<VariantCall>>* keptCalls = nullptr; // where the writer also keeps the calls, if set
     
     Combination combi; // computes nCr
     Phred phred; // computes phred probabilities
     
-    vector<string>& pileup;
+    RowSource& rows; // source of pileup rows
 //    vector<Pileup>& positions;
     
+    void processRows(); // worker loop, processes rows until the source is exhausted
+    void writeResults(); // writer loop, writes calls in input order until all rows are processed
+    
 public:
-    App(Config& config, vector<string>& bamIDs, vector<string>& pileupRows);
+    App(Config& config, vector<string>& bamIDs, RowSource& rows);
     
-    void processRow(int rowN); // processes row of data
+    RowResult processRow(Row& row); // processes row of data. Returns the call, or the site for the reference blocks if nothing is called
+    RowResult processPileup(Pileup& position, long rowN); // processes a parsed site, rowN being its row in the input
     void runAlgo(); // Runs main algorithm
+    void keepCalls(vector<unique_ptr<VariantCall>>* calls); // makes runAlgo append each call to calls, in output order, once it is written
 };
 
 #endif /* app_hpp */
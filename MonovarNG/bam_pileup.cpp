@@ -0,0 +1,147 @@
+//
+//  bam_pileup.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "bam_pileup.hpp"
+#include "pileup.hpp"
+#include "single_cell_pos.hpp"
+
+#include <htslib/cram.h>
+
+#include <string>
+#include <vector>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace std;
+
+BamPileupReader::BamPileupReader(vector<string> filenames, string referenceFilename, int minMapQ, int minBaseQ, size_t queueSize): StreamingRowSource(queueSize), minBaseQ(minBaseQ) {
+    fprintf(stderr, "Piling up %d alignment files\n", (int) filenames.size());
+    if (!filenames.size()) throw invalid_argument("No alignment files given");
+    
+    reference = fai_load(referenceFilename.c_str());
+    if (!reference) throw runtime_error("Could not load reference " + referenceFilename);
+    
+    cellFiles.resize(filenames.size());
+    vector<void*> data;
+    refs_t* sharedRefs = nullptr; // reference cache of the first cram file, shared by all later ones
+    for (int i = 0; i < filenames.size(); i++) {
+        CellFile& cell = cellFiles[i];
+        cell.file = sam_open(filenames[i].c_str(), "r");
+        if (!cell.file) throw runtime_error("Could not open alignment file " + filenames[i]);
+        if (hts_get_format(cell.file)->format == cram) {
+            // All cram files decode against one reference cache, so each contig is loaded once rather than once per cell
+            if (hts_set_fai_filename(cell.file, referenceFilename.c_str()) < 0) throw runtime_error("Could not use reference " + referenceFilename + " for " + filenames[i]);
+            if (sharedRefs && hts_set_opt(cell.file, CRAM_OPT_SHARED_REF, sharedRefs) < 0) throw runtime_error("Could not share reference cache with " + filenames[i]);
+            if (!sharedRefs) sharedRefs = cram_get_refs(cell.file);
+            // Skip decoding fields the pileup does not use; names are kept for overlap detection
+            hts_set_opt(cell.file, CRAM_OPT_REQUIRED_FIELDS, SAM_QNAME | SAM_FLAG | SAM_RNAME | SAM_POS | SAM_MAPQ | SAM_CIGAR | SAM_RNEXT | SAM_PNEXT | SAM_SEQ | SAM_QUAL);
+        }
+        cell.header = sam_hdr_read(cell.file);
+        if (!cell.header) throw runtime_error("Could not read header of " + filenames[i]);
+        cell.minMapQ = minMapQ;
+        data.push_back(&cell);
+    }
+    
+    // Same defaults as samtools mpileup: overlapping mates are counted once, and depth is capped per file
+    pileupIter = bam_mplp_init(cellFiles.size(), readAlignment, data.data());
+    if (!pileupIter) throw runtime_error("Could not set up pileup");
+    bam_mplp_init_overlaps(pileupIter);
+    bam_mplp_set_maxcnt(pileupIter, 8000);
+    depths.resize(cellFiles.size());
+    entries.resize(cellFiles.size());
+    
+    start();
+}
+
+BamPileupReader::~BamPileupReader() {
+    stop();
+    if (pileupIter) bam_mplp_destroy(pileupIter);
+    for (auto& cell: cellFiles) {
+        if (cell.header) bam_hdr_destroy(cell.header);
+        if (cell.file) sam_close(cell.file);
+    }
+    free(refSequence);
+    if (reference) fai_destroy(reference);
+}
+
+int BamPileupReader::readAlignment(void* data, bam1_t* b) {
+    // Reads the next alignment of a cell, skipping those samtools mpileup skips by default
+    CellFile* cell = (CellFile*) data;
+    while (true) {
+        int ret = sam_read1(cell->file, cell->header, b);
+        if (ret < 0) return ret;
+        if (b->core.flag & (BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP)) continue;
+        if ((b->core.flag & BAM_FPAIRED) && !(b->core.flag & BAM_FPROPER_PAIR)) continue; // anomalous pair
+        if (b->core.qual < cell->minMapQ) continue;
+        return ret;
+    }
+}
+
+char BamPileupReader::referenceBase(int tid, int pos) {
+    // Gets the reference base, loading the whole contig when the pileup moves on to a new one
+    if (tid != refTid) {
+        free(refSequence);
+        refSequence = faidx_fetch_seq(reference, cellFiles[0].header->target_name[tid], 0, INT_MAX, &refLength);
+        if (!refSequence) refLength = 0; // contig missing from reference
+        refTid = tid;
+    }
+    if (pos >= refLength) return 'N';
+    return toupper(refSequence[pos]);
+}
+
+bool BamPileupReader::readRow(Row& row) {
+    // Piles up the next covered position. Bases are written with the symbols of samtools mpileup, so sites behave exactly like parsed rows
+    int tid, pos;
+    int ret = bam_mplp_auto(pileupIter, &tid, &pos, depths.data(), entries.data());
+    if (ret < 0) throw runtime_error("Error while piling up alignments");
+    if (ret == 0) return false;
+    
+    int numCells = cellFiles.size();
+    unique_ptr<Pileup> site(new Pileup());
+    site->seqID = cellFiles[0].header->target_name[tid];
+    site->seqPos = pos+1;
+    site->refBase = referenceBase(tid, pos);
+    site->numCells = numCells;
+    
+    // Each cell gets room for its bases followed by its qualities
+    size_t totalDepth = 0;
+    for (int depth: depths) totalDepth += depth;
+    site->storage.resize(2*totalDepth);
+    char* out = site->storage.data();
+    
+    site->cells.reserve(numCells);
+    for (int i = 0; i < numCells; i++) {
+        char* bases = out;
+        char* qualities = out + depths[i];
+        int numReads = 0;
+        for (int j = 0; j < depths[i]; j++) {
+            const bam_pileup1_t* p = entries[i] + j;
+            const bam1_t* b = p->b;
+            int quality = p->qpos < b->core.l_qseq ? bam_get_qual(b)[p->qpos] : 0;
+            if (!p->is_del && !p->is_refskip && quality < minBaseQ) continue; // deletions and skips have no base quality of their own, so samtools keeps them
+            
+            char base;
+            if (p->is_refskip) base = bam_is_rev(b) ? '<' : '>';
+            else if (p->is_del) base = '*';
+            else {
+                base = seq_nt16_str[bam_seqi(bam_get_seq(b), p->qpos)];
+                if (base == '=' || (base == site->refBase && base != 'N')) base = bam_is_rev(b) ? ',' : '.';
+                else if (bam_is_rev(b)) base = tolower(base);
+            }
+            bases[numReads] = base;
+            qualities[numReads] = quality + 33 < 126 ? quality + 33 : 126;
+            numReads++;
+        }
+        site->cells.push_back(SingleCellPos(numReads, boost::string_view(bases, numReads), boost::string_view(qualities, numReads)));
+        out += 2*depths[i];
+    }
+    
+    row.site = move(site);
+    return true;
+}
@@ -0,0 +1,49 @@
+//
+//  bam_pileup.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef bam_pileup_hpp
+#define bam_pileup_hpp
+
+#include "row_source.hpp"
+
+#include <htslib/sam.h>
+#include <htslib/faidx.h>
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class BamPileupReader: public StreamingRowSource {
+    // Piles up the bam or cram files of all cells with htslib's mpileup engine, handing sites straight to the workers without writing or parsing pileup text
+    struct CellFile {
+        // An alignment file for one cell, with the read filters applied while piling up
+        samFile* file = nullptr;
+        sam_hdr_t* header = nullptr;
+        int minMapQ = 0; // reads with lower mapping quality are skipped
+    };
+    vector<CellFile> cellFiles; // one per cell, in the order of the bam list
+    bam_mplp_t pileupIter = nullptr;
+    vector<int> depths; // number of pileup entries for each cell at the current position
+    vector<const bam_pileup1_t*> entries; // pileup entries for each cell at the current position
+    int minBaseQ; // bases with lower quality are skipped
+    
+    faidx_t* reference = nullptr;
+    int refTid = -1; // contig held in refSequence
+    char* refSequence = nullptr; // sequence of contig refTid
+    int refLength = 0; // length of refSequence
+    
+    static int readAlignment(void* data, bam1_t* b); // mpileup callback, reads the next alignment of a cell that passes the filters
+    char referenceBase(int tid, int pos); // gets the upper case reference base at 0-based pos on contig tid, or N if unknown
+    bool readRow(Row& row); // piles up the next covered position into row.site
+public:
+    BamPileupReader(vector<string> filenames, string referenceFilename, int minMapQ, int minBaseQ, size_t queueSize); // opens one alignment file per cell and starts piling up. Cram files are decoded against referenceFilename
+    ~BamPileupReader();
+};
+
+#endif /* bam_pileup_hpp */
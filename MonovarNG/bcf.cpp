@@ -0,0 +1,162 @@
+//
+//  bcf.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "bcf.hpp"
+
+#include <boost/algorithm/string.hpp>
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <ctime>
+#include <stdexcept>
+
+using namespace std;
+
+BCFDocument::BCFDocument(string filename, int ioThreads, int sparseGQ): VariantDocument(sparseGQ), filename(filename) {
+    file = hts_open(filename.c_str(), "wb");
+    if (!file) throw runtime_error("Could not create output file " + filename);
+    if (ioThreads > 0 && hts_set_threads(file, ioThreads) < 0) throw runtime_error("Could not start compression threads");
+    header = bcf_hdr_init("w");
+    record = bcf_init();
+    if (!header || !record) throw runtime_error("Could not set up bcf output");
+}
+
+BCFDocument::~BCFDocument() {
+    // Best effort, as a destructor can not throw: errors are only thrown from an explicit close
+    try {
+        close();
+    } catch (exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+void BCFDocument::close() {
+    // Flushes and closes the file
+    // Everything is released before an error is thrown, so that a second close, as from the destructor, does nothing
+    if (!file) return;
+    bcf_destroy(record);
+    bcf_hdr_destroy(header);
+    record = nullptr;
+    header = nullptr;
+    int closed = hts_close(file);
+    file = nullptr;
+    if (closed < 0) throw runtime_error("Could not write to " + filename);
+}
+
+void BCFDocument::writeDefHeader() {
+    // adds the date and format specs to the header, which is written by writeHeaderInfo
+    char date[16];
+    time_t time_c = chrono::system_clock::to_time_t(chrono::system_clock::now());
+    strftime(date, sizeof(date), "%F", localtime(&time_c));
+    bcf_hdr_append(header, ("##fileDate=" + string(date)).c_str());
+    for (string& line: defHeaderLines()) {
+        if (bcf_hdr_append(header, line.c_str()) < 0) throw runtime_error("Could not add header line " + line);
+    }
+}
+
+void BCFDocument::writeHeaderInfo(string referenceFilename, vector<string> bamIDs) {
+    // adds reference, contigs and samples, then writes the header
+    bcf_hdr_append(header, ("##reference=file:" + referenceFilename).c_str());
+    
+    // Rows refer to contigs by their number in the header, so all contigs are declared up front
+    ifstream fai(referenceFilename + ".fai");
+    if (!fai) throw runtime_error("bcf output needs the reference index " + referenceFilename + ".fai; create it with samtools faidx");
+    string line;
+    vector<string> tokens;
+    while (getline(fai, line)) {
+        boost::split(tokens, line, boost::is_any_of("\t"));
+        if (tokens.size() < 2) continue;
+        bcf_hdr_append(header, ("##contig=<ID=" + tokens[0] + ",length=" + tokens[1] + ">").c_str());
+    }
+    
+    for (string& bam: bamIDs) {
+        if (bcf_hdr_add_sample(header, bam.c_str()) < 0) throw runtime_error("Could not add sample " + bam);
+    }
+    if (bcf_hdr_sync(header) < 0 || bcf_hdr_write(file, header) < 0) throw runtime_error("Could not write to " + filename);
+    
+    int numCells = bamIDs.size();
+    gt.resize(2*numCells);
+    ad.resize(2*numCells);
+    dp.resize(numCells);
+    gq.resize(numCells);
+    pl.resize(3*numCells);
+}
+
+void BCFDocument::writeRow(const VariantCall& call) {
+    // encodes the same fields as VCFDocument::formatRow, apart from the trailing genotype summary, which has no place in bcf
+    char baseMap[5] = {'A', 'C', 'T', 'G'};
+    const vector<int>& genotypes = call.genotypes;
+    bcf_clear(record);
+    record->rid = bcf_hdr_name2id(header, call.chromosome.c_str());
+    if (record->rid < 0) throw runtime_error("Sequence " + call.chromosome + " is not in the reference index");
+    record->pos = call.posID - 1;
+    record->qual = call.quality;
+    char alleles[4] = {baseMap[call.ref], ',', baseMap[call.alt], 0};
+    bcf_update_alleles_str(header, record, alleles);
+    
+    int32_t altCount = 0, alleleCount = 0;
+    for (int i: genotypes) {
+        if (i != -1) {
+            altCount += i;
+            alleleCount += 2;
+        }
+    }
+    float altFreq = double(altCount)/alleleCount;
+    float baseQRankSum = call.wilcoxon, qd = call.qualityByDepth, sor = call.strandBias, psarrValue = call.psarr;
+    int32_t totalDepth = call.depth;
+    bcf_update_info_int32(header, record, "AC", &altCount, 1);
+    bcf_update_info_float(header, record, "AF", &altFreq, 1);
+    bcf_update_info_int32(header, record, "AN", &alleleCount, 1);
+    bcf_update_info_float(header, record, "BaseQRankSum", &baseQRankSum, 1);
+    bcf_update_info_int32(header, record, "DP", &totalDepth, 1);
+    bcf_update_info_float(header, record, "QD", &qd, 1);
+    bcf_update_info_float(header, record, "SOR", &sor, 1);
+    bcf_update_info_float(header, record, "PSARR", &psarrValue, 1);
+    
+    // Cells without a call are missing in every FORMAT field, and so are all but GT of collapsed cells for sparse output
+    informative.clear();
+    int likelihoodsIndex = 0;
+    for (int i = 0; i < genotypes.size(); i++) {
+        if (genotypes[i] == -1) {
+            gt[2*i] = gt[2*i+1] = bcf_gt_missing;
+            ad[2*i] = bcf_int32_missing;
+            ad[2*i+1] = bcf_int32_vector_end;
+            dp[i] = gq[i] = bcf_int32_missing;
+            pl[3*i] = bcf_int32_missing;
+            pl[3*i+1] = pl[3*i+2] = bcf_int32_vector_end;
+            continue;
+        }
+        gt[2*i] = bcf_gt_unphased(genotypes[i] == 2);
+        gt[2*i+1] = bcf_gt_unphased(genotypes[i] >= 1);
+        double quals[3];
+        gq[i] = genotypeQualities(call.likelihoods[likelihoodsIndex++], quals);
+        if (collapsed(genotypes[i], gq[i])) {
+            ad[2*i] = bcf_int32_missing;
+            ad[2*i+1] = bcf_int32_vector_end;
+            dp[i] = gq[i] = bcf_int32_missing;
+            pl[3*i] = bcf_int32_missing;
+            pl[3*i+1] = pl[3*i+2] = bcf_int32_vector_end;
+            continue;
+        }
+        informative.push_back(i);
+        ad[2*i] = call.cellDepths[i].first;
+        ad[2*i+1] = call.cellDepths[i].second;
+        dp[i] = call.cellDepths[i].first + call.cellDepths[i].second;
+        for (int j = 0; j < 3; j++) pl[3*i+j] = quals[j];
+    }
+    if (sparseGQ >= 0 && informative.size()) bcf_update_info_int32(header, record, "IC", informative.data(), informative.size());
+    bcf_update_genotypes(header, record, gt.data(), gt.size());
+    bcf_update_format_int32(header, record, "AD", ad.data(), ad.size());
+    bcf_update_format_int32(header, record, "DP", dp.data(), dp.size());
+    bcf_update_format_int32(header, record, "GQ", gq.data(), gq.size());
+    bcf_update_format_int32(header, record, "PL", pl.data(), pl.size());
+    
+    if (bcf_write(file, header, record) < 0) throw runtime_error("Could not write to " + filename);
+}
@@ -0,0 +1,43 @@
+//
+//  bcf.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef bcf_hpp
+#define bcf_hpp
+
+#include "vcf.hpp"
+#include "wrdouble.hpp"
+
+#include <htslib/vcf.h>
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <array>
+
+using namespace std;
+
+class BCFDocument: public VariantDocument {
+    // Writes variants as compressed bcf through htslib, encoding INFO and FORMAT fields as typed values instead of text
+    string filename;
+    htsFile* file = nullptr;
+    bcf_hdr_t* header = nullptr;
+    bcf1_t* record = nullptr; // reused for every row
+    
+    // FORMAT values of a row, one entry per cell (GT, AD: two per cell; PL: three per cell), kept to reuse their storage
+    vector<int32_t> gt, ad, dp, gq, pl;
+    vector<int32_t> informative; // cells written in full, for sparse output
+public:
+    BCFDocument(string filename, int ioThreads = 2, int sparseGQ = -1); // creates filename, compressed on ioThreads threads. sparseGQ >= 0 selects sparse output
+    ~BCFDocument();
+    
+    void writeDefHeader();
+    void writeHeaderInfo(string referenceFilename, vector<string> bamIDs); // contigs are taken from the index of referenceFilename (.fai), which bcf needs before the first row
+    void writeRow(const VariantCall& call);
+    void close();
+};
+
+#endif /* bcf_hpp */
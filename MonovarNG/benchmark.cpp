@@ -0,0 +1,214 @@
+//
+//  benchmark.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "benchmark.hpp"
+#include "wrdouble.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+#define NOINLINE __attribute__((noinline))
+
+struct legacyWrdouble {
+    // wrdouble as it was when its operators lived in wrdouble.cpp: every call is out of line, and a double is normalized by repeated multiplication
+    static double base;
+    static double invBase;
+    
+    double value;
+    int exponent;
+    
+    NOINLINE legacyWrdouble() {}
+    NOINLINE legacyWrdouble(double value, int exponent): value(value), exponent(exponent) {}
+    NOINLINE legacyWrdouble(double n);
+    
+    NOINLINE operator double();
+    NOINLINE bool operator<(legacyWrdouble& n);
+    NOINLINE legacyWrdouble operator*(const legacyWrdouble& n) const;
+    NOINLINE legacyWrdouble operator/(const legacyWrdouble& n) const;
+    NOINLINE legacyWrdouble operator+(const legacyWrdouble& n) const;
+    NOINLINE legacyWrdouble& operator+=(const legacyWrdouble& n);
+};
+
+double legacyWrdouble::base = pow(double(2), 64);
+double legacyWrdouble::invBase = pow(double(2), -64);
+
+legacyWrdouble::legacyWrdouble(double n) {
+    if (n == 0) {
+        value = 0;
+        exponent = -1e6;
+        return;
+    }
+    exponent = 0;
+    value = n;
+    while (value < 1) {
+        exponent--;
+        value *= base;
+    }
+    while (value >= base) {
+        exponent++;
+        value *= invBase;
+    }
+}
+
+legacyWrdouble::operator double() {
+    double n = value;
+    n *= pow(base, exponent);
+    if (isinf(n) || isnan(n)) return 0;
+    return n;
+}
+
+bool legacyWrdouble::operator<(legacyWrdouble& n) {
+    if (exponent < n.exponent) return true;
+    else if (exponent > n.exponent) return false;
+    else return value < n.value;
+}
+
+legacyWrdouble legacyWrdouble::operator*(const legacyWrdouble& n) const {
+    int newexp = exponent + n.exponent;
+    double newval = value * n.value;
+    if (newval >= base) {
+        newexp++;
+        newval *= invBase;
+    }
+    return legacyWrdouble(newval, newexp);
+}
+
+legacyWrdouble legacyWrdouble::operator/(const legacyWrdouble& n) const {
+    int newexp = exponent - n.exponent;
+    double newval = value / n.value;
+    if (newval < 1 && newval != 0) {
+        newexp--;
+        newval *= base;
+    }
+    return legacyWrdouble(newval, newexp);
+}
+
+legacyWrdouble legacyWrdouble::operator+(const legacyWrdouble& n) const {
+    legacyWrdouble sum = *this;
+    return sum += n;
+}
+
+legacyWrdouble& legacyWrdouble::operator+=(const legacyWrdouble& n) {
+    if (exponent > n.exponent+1) {}
+    else if (exponent + 1 < n.exponent) {
+        value = n.value;
+        exponent = n.exponent;
+    } else if (exponent == n.exponent) {
+        value += n.value;
+        if (value >= base) {
+            exponent++;
+            value *= invBase;
+        }
+    } else if (exponent == n.exponent + 1) {
+        value += n.value*invBase;
+        if (value >= base) {
+            exponent++;
+            value *= invBase;
+        }
+    } else {
+        value = value*invBase + n.value;
+        exponent = n.exponent;
+        if (value >= base) {
+            exponent++;
+            value *= invBase;
+        }
+    }
+    return *this;
+}
+
+static const int numValues = 4096; // operands per pass, small enough to stay in cache
+
+template<class T>
+struct Operands {
+    // The same random operands for both types, spread over the range of cell likelihoods
+    vector<double> doubles;
+    vector<T> a, b, c;
+    
+    Operands(const vector<double>& doubles): doubles(doubles), c(numValues, T(1.0)) {
+        for (int i = 0; i < numValues; i++) {
+            a.push_back(T(doubles[i]));
+            b.push_back(T(doubles[(i*7+3) % numValues]));
+        }
+    }
+};
+
+template<class Pass>
+static double nsPerOperation(long operations, Pass pass) {
+    // Runs pass, which does numValues operations, until operations are done
+    long passes = max(1L, operations/numValues);
+    auto start = chrono::high_resolution_clock::now();
+    for (long i = 0; i < passes; i++) {
+        pass();
+        __asm__ __volatile__("" ::: "memory"); // keeps the passes from being merged
+    }
+    auto end = chrono::high_resolution_clock::now();
+    return double(chrono::duration_cast<chrono::nanoseconds>(end-start).count()) / (passes*numValues);
+}
+
+template<class T>
+static vector<double> timeOperations(long operations, const vector<double>& doubles, double& checksum) {
+    // ns per operation of each kernel, in the order of the names in wrdoubleThroughput
+    Operands<T> x(doubles);
+    int less = 0;
+    double sum = 0;
+    T l0(0.6), l1(0.3), l2(0.1); // weights of a dp step
+    vector<double> times;
+    times.push_back(nsPerOperation(operations, [&]() { for (int i = 0; i < numValues; i++) x.c[i] = T(x.doubles[i]); }));
+    times.push_back(nsPerOperation(operations, [&]() { for (int i = 0; i < numValues; i++) x.c[i] = x.a[i] * x.b[i]; }));
+    times.push_back(nsPerOperation(operations, [&]() { for (int i = 0; i < numValues; i++) x.c[i] = x.a[i] / x.b[i]; }));
+    times.push_back(nsPerOperation(operations, [&]() { for (int i = 0; i < numValues; i++) x.c[i] = x.a[i] + x.b[i]; }));
+    times.push_back(nsPerOperation(operations, [&]() { for (int i = 0; i < numValues; i++) less += x.a[i] < x.b[i]; }));
+    times.push_back(nsPerOperation(operations, [&]() { for (int i = 0; i < numValues; i++) sum += double(x.a[i]); }));
+    times.push_back(nsPerOperation(operations, [&]() { for (int i = 2; i < numValues; i++) x.c[i] = x.a[i]*l0 + x.a[i-1]*l1 + x.a[i-2]*l2; }));
+    
+    for (int i = 0; i < numValues; i++) sum += double(x.c[i]);
+    checksum += sum + less;
+    return times;
+}
+
+static int conversionMismatches(const vector<double>& doubles, int& compared) {
+    // Compares the conversion to double of both types at every exponent where a double can come out, and one beyond on each side
+    int mismatches = 0;
+    compared = 0;
+    for (int exponent = -18; exponent <= 16; exponent++) {
+        for (double value: doubles) {
+            double scaled = value * 1e30; // into [1, base), where wrdouble values lie
+            if (scaled < 1 || scaled >= wrdouble::base) continue;
+            double current = double(wrdouble(scaled, exponent));
+            double previous = double(legacyWrdouble(scaled, exponent));
+            mismatches += memcmp(&current, &previous, sizeof(double)) != 0;
+            compared++;
+        }
+    }
+    return mismatches;
+}
+
+void benchmark::wrdoubleThroughput(long operations, FILE* out) {
+    // Times each wrdouble operation against the previous out-of-line implementation, and writes the ns per operation to out
+    const char* names[] = {"from double", "multiply", "divide", "add", "compare", "to double", "dp step (3 *, 2 +)"};
+    mt19937 random(1);
+    uniform_real_distribution<double> log10Value(-30, 0);
+    vector<double> doubles;
+    for (int i = 0; i < numValues; i++) doubles.push_back(pow(10, log10Value(random)));
+    
+    double checksum = 0; // printed, so that no kernel is optimized away
+    vector<double> legacy = timeOperations<legacyWrdouble>(operations, doubles, checksum);
+    vector<double> inlined = timeOperations<wrdouble>(operations, doubles, checksum);
+    
+    fprintf(out, "%-20s %12s %12s %8s\n", "operation", "out of line", "header", "speedup");
+    for (size_t i = 0; i < legacy.size(); i++) fprintf(out, "%-20s %9.2lf ns %9.2lf ns %7.2lfx\n", names[i], legacy[i], inlined[i], legacy[i]/inlined[i]);
+    fprintf(out, "%ld operations each, checksum %g\n", max(1L, operations/numValues)*numValues, checksum);
+    int compared;
+    int mismatches = conversionMismatches(doubles, compared);
+    fprintf(out, "to double: %d of %d conversions differ from the out of line implementation\n", mismatches, compared);
+}
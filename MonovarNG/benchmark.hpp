@@ -0,0 +1,19 @@
+//
+//  benchmark.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef benchmark_hpp
+#define benchmark_hpp
+
+#include <stdio.h>
+
+using namespace std;
+
+namespace benchmark {
+    void wrdoubleThroughput(long operations, FILE* out); // times each wrdouble operation against the previous out-of-line implementation, and writes the ns per operation to out
+}
+
+#endif /* benchmark_hpp */
@@ -0,0 +1,66 @@
+//
+//  bounded_queue.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef bounded_queue_hpp
+#define bounded_queue_hpp
+
+#include <stdio.h>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+template<class T>
+class BoundedQueue {
+    // Blocking FIFO queue with a fixed capacity, for handing items from producers to consumers
+    size_t capacity; // maximum number of items held at once
+    deque<T> items;
+    bool closed = false; // set once no more items will be pushed
+
+    mutex queueMutex;
+    condition_variable notFull; // signalled when an item is popped
+    condition_variable notEmpty; // signalled when an item is pushed, or the queue is closed
+
+public:
+    BoundedQueue(size_t capacity): capacity(capacity ? capacity : 1) {}
+
+    bool push(T&& item) {
+        // adds item, waiting while the queue is full. Returns false if the queue was closed
+        unique_lock<mutex> lock(queueMutex);
+        notFull.wait(lock, [this]{ return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        // takes the oldest item, waiting while the queue is empty. Returns false once the queue is closed and drained
+        unique_lock<mutex> lock(queueMutex);
+        notEmpty.wait(lock, [this]{ return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        // stops accepting items; consumers drain what is left and then see the end
+        {
+            lock_guard<mutex> lock(queueMutex);
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+#endif /* bounded_queue_hpp */
@@ -10,34 +10,45 @@
 #include "wrdouble.hpp"
 
 #include <vector>
+#include <cmath>
+#include <stdexcept>
+#include <string>
 
 using namespace std;
 
 Combination::Combination(){} // default constructor
 
 Combination::Combination(int width): width(width) {
+    if (width > maxTableWidth) return; // rows are built by getRow
     mem.resize(width+1);
-    for (auto &row: mem) row.resize(width+1);
-    // first row
-    mem[0][0] = 1.0; // 0C0 = 1
-    for (int j = 1; j <= width; j++) {
-        mem[0][j] = 0.0;
-    }
-    // other rows
+    mem[0].assign(1, 1.0); // 0C0 = 1
     for (int i = 1; i <= width; i++) {
-        mem[i][0] = 1; // nC0 = 1
-        for (int j = 1; j <= width; j++) {
+        mem[i].resize(i+1);
+        mem[i][0] = mem[i][i] = 1; // nC0 = nCn = 1
+        for (int j = 1; j < i; j++) {
             mem[i][j] = mem[i-1][j] + mem[i-1][j-1];
         }
     }
 }
 
-const vector<wrdouble> Combination::getRow(int n) const {
-    // Gets the row for nC0...nCn
-    return mem[n];
+void Combination::getRow(int n, vector<wrdouble>& row) const {
+    // Sets row to nC0...nCn. Beyond the table, the row is built in place by Pascal's rule, adding in the same order as the table, so the values are identical
+    if (n < 0 || n > width) throw out_of_range("Combination: row " + to_string(n) + " beyond width " + to_string(width));
+    if (mem.size()) {
+        row = mem[n];
+        return;
+    }
+    row.assign(n+1, wrdouble(0.0));
+    row[0] = 1.0;
+    for (int i = 1; i <= n; i++) {
+        for (int j = i; j >= 1; j--) row[j] = row[j] + row[j-1]; // from the end, so row[j-1] still holds row i-1
+    }
 }
 
 wrdouble Combination::getValue(int n, int r) const {
-    // Gets nCr
-    return mem[n][r];
+    // Gets nCr for r <= 2, which is all computeC needs. 0 for r > n, as in Pascal's triangle
+    if (r == 0) return 1.0;
+    if (r == 1) return double(n);
+    if (r == 2) return double(n)*(n-1)/2;
+    throw out_of_range("Combination: nCr only for r <= 2, not " + to_string(r));
 }
@@ -16,14 +16,16 @@
 
 using namespace std;
 
-class Combination { // Computes nCr and stores it for use
+class Combination { // Computes nCr and stores it for use, up to maxTableWidth. Wider rows are built on demand, so memory grows linearly beyond it
     int width;
-    vector<vector<wrdouble>> mem; // stores nCr
+    vector<vector<wrdouble>> mem; // stores nCr, row n holding nC0...nCn. Empty if width > maxTableWidth
 public:
+    static const int maxTableWidth = 1000; // the table takes about 8 MB at this width
+    
     Combination(); // default constructor
     Combination (int width); // width = largest n, 0C0 to widthCwidth. Width at least 1
-    const vector<wrdouble> getRow(int n) const; // gets the row for nC0...nCn
-    wrdouble getValue(int n, int r) const; // gets nCr
+    void getRow(int n, vector<wrdouble>& row) const; // sets row to nC0...nCn, the same values whether stored or built
+    wrdouble getValue(int n, int r) const; // gets nCr for r <= 2, in closed form
 };
 
 #endif /* combination_hpp */
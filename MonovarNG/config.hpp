@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <string>
+#include <vector>
 
 struct Config {
     // Main configuration for CLI
@@ -18,12 +19,26 @@ struct Config {
     std::string bamfileNames; // name of file containing bamfile names
     std::string pileupFilename; // name of pileup file
     std::string outputFilename; // name of output file
+    std::string matrixPrefix; // prefix of the files for the bit-packed genotype matrix, empty for none
+    std::string blockFilename; // name of file for reference blocks of the sites not called, empty for none
+    std::vector<std::string> regions; // regions to call, as chr, chr:start or chr:start-end. Empty for the whole input
+    std::string inputMode = "stream"; // how the pileup is read: stream (buffered reads), mmap (zero-copy memory map) or bam (pile up the bam files directly)
     
     double mutationThreshold = 0.05; // threshold for variant calling
     double pFalsePositive = 0.002; // p_e, prior probability for false positive 
     double pDropout = 0.02; // p_ad, prior probability for allelic dropout
+    std::string numericEngine = "wrdouble"; // numbers for likelihoods and dp: wrdouble (extended range) or log (log space)
+    
+    int shard = 0, numShards = 1; // part of an indexed pileup to call, as a share of its bytes, for splitting a run across jobs
     
     int numThreads = 4; // number of threads for multiprocessing
+    int queueSize = 1024; // maximum number of pileup rows buffered ahead of the workers
+    int reorderSize = 16384; // maximum number of finished rows held back to write the output in input order
+    int ioThreads = 2; // number of threads for BGZF decompression, separate from numThreads
+    int sparseGQ = -1; // sparse output: reference calls with at least this GQ are written as a bare 0/0, cells without reads as a bare . (-1: every cell in full)
+    
+    int minMapQ = 0; // minimum mapping quality of reads, when piling up bam files
+    int minBaseQ = 13; // minimum base quality, when piling up bam files
     
     bool useConsensusFilter = false; // whether to use Consensus Filter (CF) 
 };
@@ -0,0 +1,87 @@
+//
+//  genotype_matrix.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "genotype_matrix.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+static const char matrixMagic[8] = {'M', 'V', 'G', 'T', '0', '0', '0', '1'};
+
+static void putU64(FILE* file, uint64_t value) {
+    // writes value in little-endian order
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; i++) bytes[i] = value >> (8*i);
+    fwrite(bytes, 1, 8, file);
+}
+
+GenotypeMatrixWriter::GenotypeMatrixWriter(string prefix, const vector<string>& cellNames): prefix(prefix), numCells(cellNames.size()) {
+    rowBytes = (numCells+3) / 4;
+    row.resize(rowBytes);
+    
+    FILE* cells = fopen((prefix + ".cells").c_str(), "w");
+    if (!cells) throw runtime_error("Could not create " + prefix + ".cells");
+    for (const string& name: cellNames) fprintf(cells, "%s\n", name.c_str());
+    if (fclose(cells)) throw runtime_error("Could not write to " + prefix + ".cells");
+    
+    matrix = fopen((prefix + ".gt").c_str(), "wb");
+    sites = fopen((prefix + ".sites").c_str(), "w");
+    if (!matrix || !sites) {
+        // close whichever one did open, as the destructor does not run when the constructor throws
+        if (matrix) fclose(matrix);
+        if (sites) fclose(sites);
+        matrix = sites = nullptr;
+        throw runtime_error("Could not create " + prefix + ".gt and " + prefix + ".sites");
+    }
+    setvbuf(matrix, nullptr, _IOFBF, 1 << 20);
+    setvbuf(sites, nullptr, _IOFBF, 1 << 20);
+    
+    // The number of sites is filled in by close
+    fwrite(matrixMagic, 1, 8, matrix);
+    putU64(matrix, 0);
+    putU64(matrix, numCells);
+    putU64(matrix, rowBytes);
+}
+
+GenotypeMatrixWriter::~GenotypeMatrixWriter() {
+    // Best effort, as a destructor can not throw: errors are only thrown from an explicit close
+    try {
+        close();
+    } catch (exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+void GenotypeMatrixWriter::addSite(const string& chromosome, int posID, char ref, char alt, const vector<int>& genotypes) {
+    // ref and alt are base numbers, as in VariantCall
+    char baseMap[5] = {'A', 'C', 'T', 'G'};
+    if (genotypes.size() != numCells) throw runtime_error("Site has " + to_string(genotypes.size()) + " genotypes, expected " + to_string(numCells));
+    fill(row.begin(), row.end(), 0);
+    for (size_t i = 0; i < numCells; i++) {
+        unsigned code = genotypes[i] >= 0 && genotypes[i] <= 2 ? genotypes[i] : 3;
+        row[i/4] |= code << (2*(i%4));
+    }
+    if (fwrite(row.data(), 1, rowBytes, matrix) != rowBytes) throw runtime_error("Could not write to " + prefix + ".gt");
+    fprintf(sites, "%s\t%d\t%c\t%c\n", chromosome.c_str(), posID, baseMap[(int) ref], baseMap[(int) alt]);
+    numSites++;
+}
+
+void GenotypeMatrixWriter::close() {
+    if (!matrix) return;
+    bool failed = fseek(matrix, 8, SEEK_SET) != 0;
+    putU64(matrix, numSites);
+    failed |= fclose(matrix) != 0;
+    failed |= fclose(sites) != 0;
+    matrix = sites = nullptr;
+    if (failed) throw runtime_error("Could not write to " + prefix + ".gt and " + prefix + ".sites");
+}
@@ -0,0 +1,39 @@
+//
+//  genotype_matrix.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef genotype_matrix_hpp
+#define genotype_matrix_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// The genotypes of the called sites as a sites x cells matrix of 2-bit codes, for tools that want the matrix without parsing the vcf. Written as three files:
+//   <prefix>.gt: the magic "MVGT0001", then uint64 sites, uint64 cells and uint64 bytes per site, in little-endian order, then one row of bytes per site.
+//     Cell i of a row is in byte i/4, bits 2*(i%4) and up: 0 for 0/0, 1 for 0/1, 2 for 1/1, 3 for no call. Rows start at byte 32 + site * bytes per site, so the file can be mapped and indexed directly
+//   <prefix>.sites: one line per row, chromosome<TAB>position<TAB>ref<TAB>alt, in the order of the vcf
+//   <prefix>.cells: one line per column, the sample names of the vcf
+
+class GenotypeMatrixWriter {
+    // Appends the genotypes of each call as a row of the matrix
+    string prefix;
+    FILE* matrix = nullptr; // <prefix>.gt
+    FILE* sites = nullptr; // <prefix>.sites
+    size_t numCells, rowBytes;
+    size_t numSites = 0; // rows written so far, filled into the header by close
+    vector<unsigned char> row; // packed row, reused for every site
+public:
+    GenotypeMatrixWriter(string prefix, const vector<string>& cellNames); // creates the three files, writing the cell names
+    ~GenotypeMatrixWriter();
+    
+    void addSite(const string& chromosome, int posID, char ref, char alt, const vector<int>& genotypes); // appends a row; genotypes as from Pileup::computeGenotype, -1 for no call
+    void close(); // fills in the number of sites and closes the files
+};
+
+#endif /* genotype_matrix_hpp */
@@ -0,0 +1,39 @@
+//
+//  log_space.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "log_space.hpp"
+#include "wrdouble.hpp"
+
+#include <cmath>
+
+using namespace std;
+
+static const double lnBase = 64*logSpace::ln2; // log of wrdouble::base
+
+double logSpace::safeLog(double x) {
+    return x > 0 ? log(x) : logZero;
+}
+
+double logSpace::fromWrdouble(const wrdouble& x) {
+    if (x.value <= 0) return logZero;
+    return log(x.value) + x.exponent*lnBase;
+}
+
+wrdouble logSpace::toWrdouble(double x) {
+    // Splits x into a multiple of log(base) and a remainder, so that the value lies in [1, base)
+    if (x <= logZero/2) return wrdouble(0);
+    int exponent = floor(x/lnBase);
+    double value = exp(x - exponent*lnBase);
+    if (value < 1) {
+        value *= wrdouble::base;
+        exponent--;
+    } else if (value >= wrdouble::base) {
+        value *= wrdouble::invBase;
+        exponent++;
+    }
+    return wrdouble(value, exponent);
+}
@@ -0,0 +1,114 @@
+//
+//  log_space.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef log_space_hpp
+#define log_space_hpp
+
+#include "wrdouble.hpp"
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+// Numbers kept as their natural logarithm, an alternative to wrdouble for the likelihoods and dp of Pileup.
+// The kernels are inline and free of calls and branches, so loops over arrays of them can be vectorized. The release build uses -Ofast,
+// so nothing relies on infinities: log(0) is the finite logZero, which stays far below any real value under the additions the dp makes
+
+namespace logSpace {
+    const double logZero = -1e300; // stands for log(0)
+    const double ln2 = 0.6931471805599453;
+    
+    inline double fromBits(uint64_t bits) {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    
+    inline uint64_t toBits(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+    
+    inline double fastExp(double x) {
+        // e^x, to a relative error of about 1e-13 under -Ofast. Arguments below -708 give 0, so logZero and differences with it vanish
+        double clamped = min(max(x, -708.0), 709.0);
+        int k = int(clamped*1.4426950408889634 + 1024.5) - 1024; // nearest power of 2; the offset keeps the truncation on positive numbers
+        double r = clamped - k*0.6931471803691238 - k*1.9082149292705877e-10; // |r| <= ln2/2
+        
+        // Taylor series of e^r to r^13
+        double p = 1.0/6227020800;
+        p = p*r + 1.0/479001600;
+        p = p*r + 1.0/39916800;
+        p = p*r + 1.0/3628800;
+        p = p*r + 1.0/362880;
+        p = p*r + 1.0/40320;
+        p = p*r + 1.0/5040;
+        p = p*r + 1.0/720;
+        p = p*r + 1.0/120;
+        p = p*r + 1.0/24;
+        p = p*r + 1.0/6;
+        p = p*r + 0.5;
+        p = p*r + 1.0;
+        p = p*r + 1.0;
+        
+        uint64_t keep = -uint64_t(x >= -708.0); // all ones, or zero to give 0
+        double scale = fromBits((uint64_t(k + 1023) << 52) & keep); // 2^k
+        return p*scale;
+    }
+    
+    inline double fastLog(double x) {
+        // natural log of a positive, normal x
+        uint64_t bits = toBits(x);
+        int exponent = int(bits >> 52) - 1023;
+        double m = fromBits((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL); // 1 <= m < 2
+        bool high = m > 1.4142135623730951;
+        m = high ? m*0.5 : m;
+        exponent += high;
+        
+        // log(m) = 2 atanh(z) with |z| <= 0.1716, from the series of atanh to z^23
+        double z = (m-1)/(m+1), z2 = z*z;
+        double p = 1.0/23;
+        p = p*z2 + 1.0/21;
+        p = p*z2 + 1.0/19;
+        p = p*z2 + 1.0/17;
+        p = p*z2 + 1.0/15;
+        p = p*z2 + 1.0/13;
+        p = p*z2 + 1.0/11;
+        p = p*z2 + 1.0/9;
+        p = p*z2 + 1.0/7;
+        p = p*z2 + 1.0/5;
+        p = p*z2 + 1.0/3;
+        p = p*z2 + 1.0;
+        return exponent*ln2 + 2*z*p;
+    }
+    
+    inline double logSumExp(double a, double b, double c) {
+        // log(e^a + e^b + e^c)
+        double m = max(max(a, b), c);
+        return m + fastLog(fastExp(a-m) + fastExp(b-m) + fastExp(c-m));
+    }
+    
+    inline double logSumExp(const double* x, int n) {
+        // log of the sum of e^x[i]; logZero for n = 0
+        if (n <= 0) return logZero;
+        double m = x[0];
+        for (int i = 1; i < n; i++) m = max(m, x[i]);
+        double sum = 0;
+        for (int i = 0; i < n; i++) sum += fastExp(x[i]-m);
+        return m + fastLog(sum);
+    }
+    
+    double safeLog(double x); // log(x), logZero for x <= 0
+    double fromWrdouble(const wrdouble& x); // log of a wrdouble
+    wrdouble toWrdouble(double x); // wrdouble of e^x, 0 for logZero
+}
+
+#endif /* log_space_hpp */
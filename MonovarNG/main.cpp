@@ -11,37 +11,117 @@
 #include "config.hpp"
 #include "app.hpp"
 #include "pileup.hpp"
+#include "site_cache.hpp"
+#include "pileup_index.hpp"
+#include "accuracy.hpp"
+#include "benchmark.hpp"
 
 #include <string>
 #include <vector>
+#include <memory>
 
 using namespace std;
 using namespace utility;
 
+static int writeCache(int argc, const char * argv[]) {
+    // monovar cache: prefilters and prepares the sites of a pileup once and stores them in a site cache
+    auto start = chrono::high_resolution_clock::now();
+    Config config = setupConfig(argc, argv);
+    int numCells = getBamIDs(config.bamfileNames, config.numThreads).size();
+    unique_ptr<RowSource> pileup = openPileup(config, numCells);
+    
+    SiteCacheWriter cache(config.outputFilename, numCells);
+    cache.convert(*pileup, config.numThreads, config.reorderSize);
+    cache.close();
+    
+    auto end = chrono::high_resolution_clock::now();
+    fprintf(stderr, "%ld positions read, %ld sites cached.\n", pileup->rowsRead(), cache.sitesWritten());
+    fprintf(stderr, "Total time = %lfs\n", double(chrono::duration_cast<chrono::milliseconds>(end-start).count())/1000);
+    return 0;
+}
+
+static int writeIndex(int argc, const char * argv[]) {
+    // monovar index: records where chunks of rows start in a plain-text pileup
+    if (argc < 2) throw invalid_argument("Incorrect arguments.\nUsage: monovar index pileupFile [rowsPerChunk]");
+    int chunkRows = argc > 2 ? atoi(argv[2]) : 10000;
+    pileupIndex::build(argv[1], chunkRows);
+    return 0;
+}
+
+static int reportAccuracy(int argc, const char * argv[]) {
+    // monovar accuracy: calls the pileup with wrdouble and with another numeric engine, and reports how much their calls differ
+    Config config = setupConfig(argc, argv);
+    if (config.pileupFilename == "-") throw invalid_argument("monovar accuracy reads the pileup twice, so it can not read from stdin");
+    string reportFilename = config.outputFilename;
+    config.outputFilename = "/dev/null";
+    config.blockFilename.clear();
+    config.matrixPrefix.clear();
+    
+    vector<string> bamIDs = getBamIDs(config.bamfileNames, config.numThreads);
+    string engines[2] = {"wrdouble", config.numericEngine == "wrdouble" ? "log" : config.numericEngine};
+    vector<unique_ptr<VariantCall>> calls[2];
+    for (int i = 0; i < 2; i++) {
+        fprintf(stderr, "Calling with %s\n", engines[i].c_str());
+        config.numericEngine = engines[i];
+        unique_ptr<RowSource> pileup = openPileup(config, bamIDs.size());
+        App app(config, bamIDs, *pileup);
+        app.keepCalls(&calls[i]);
+        app.runAlgo();
+    }
+    
+    FILE* report = reportFilename == "-" ? stdout : fopen(reportFilename.c_str(), "w");
+    if (!report) throw runtime_error("Could not create " + reportFilename);
+    accuracy::compareCalls(calls[0], calls[1], engines[0], engines[1], report);
+    if (report != stdout) fclose(report);
+    return 0;
+}
+
+static int runBenchmark(int argc, const char * argv[]) {
+    // monovar bench: times the wrdouble operations
+    long operations = argc > 1 ? atol(argv[1]) : 50000000;
+    benchmark::wrdoubleThroughput(operations, stdout);
+    return 0;
+}
+
+static int runTests(int argc, const char * argv[]) {
+    // monovar test: checks the combinations and the dp on large cohorts, returning 1 if any check fails
+    bool passed = testCombinations(stdout);
+    passed = testLargeCohortDP(stdout) && passed;
+    printf("%s\n", passed ? "All tests passed" : "Tests FAILED");
+    return passed ? 0 : 1;
+}
+
 int main(int argc, const char * argv[]) {
 //    test();
     
+    if (argc > 1 && string(argv[1]) == "index") return writeIndex(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "cache") return writeCache(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "accuracy") return reportAccuracy(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "bench") return runBenchmark(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "test") return runTests(argc-1, argv+1);
+    
     auto start = chrono::high_resolution_clock::now();
     Config config = setupConfig(argc, argv);
     
-    vector<string> bamIDs = getBamIDs(config.bamfileNames);
+    vector<string> bamIDs = getBamIDs(config.bamfileNames, config.numThreads);
     
     int numCells = bamIDs.size();
     
-    vector<string> pileup = readPileup(numCells, config.pileupFilename);
+    unique_ptr<RowSource> pileup = openPileup(config, numCells); // rows are read while the algorithm runs
     
-    App app(config, bamIDs, pileup);
+    App app(config, bamIDs, *pileup);
     
     auto end = chrono::high_resolution_clock::now();
     auto setupTime = end-start;
-    printf("Time for setup = %lldms\n", chrono::duration_cast<chrono::milliseconds>(setupTime).count());
+    fprintf(stderr, "Time for setup = %lldms\n", chrono::duration_cast<chrono::milliseconds>(setupTime).count());
     
     start = chrono::high_resolution_clock::now();
     app.runAlgo();
     end = chrono::high_resolution_clock::now();
     auto algoTime = end-start;
-    printf("Time for algo = %lldms\n", chrono::duration_cast<chrono::milliseconds>(algoTime).count());
-    printf("Total time = %lfs\n", double(chrono::duration_cast<chrono::milliseconds>(setupTime+algoTime).count())/1000);
+    fprintf(stderr, "%ld positions read.\n", pileup->rowsRead());
+    fprintf(stderr, "Time for algo = %lldms\n", chrono::duration_cast<chrono::milliseconds>(algoTime).count());
+    fprintf(stderr, "Total time = %lfs\n", double(chrono::duration_cast<chrono::milliseconds>(setupTime+algoTime).count())/1000);
     
     exit(0); // skip deallocation
     return 0;
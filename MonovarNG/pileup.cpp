@@ -11,35 +11,46 @@
 #include "single_cell_pos.hpp"
 #include "wrdouble.hpp"
 #include "phred.hpp"
+#include "log_space.hpp"
 #include "ap.h"
 #include "statistics.h"
 
-#include <boost/algorithm/string.hpp>
-
 #include <string>
 #include <vector>
 #include <iostream>
 #include <array>
 #include <cmath>
 #include <chrono>
+#include <stdexcept>
 
 using namespace std;
 using namespace utility;
 
-Pileup::Pileup(int numCells, string& row) : numCells(numCells) {
-    // Parses row and saves them into tokens
-    vector<string> tokens;
-    tokens.reserve(3*(numCells+1));
-    boost::split(tokens, row, boost::is_any_of("\t"));
+// Limits for computing a site in plain doubles with adaptivePrecision, as powers of 2 below 1. Doubles reach 2^-1022
+static const int maxDoubleLikelihoodExponent = 960; // for the likelihood of a cell
+static const int maxDoubleDPExponent = 300; // for the largest entry of a dp row and for h_j,0, leaving room for combinations and priors
+static const int maxDoubleCells = 100; // keeps 4^numCells and 2*numCells C l far inside the range of doubles
+
+// Largest number of cells for which computeDP shares one exponent per row. computeAltLikelihoods divides entries by 2*numCells C l, up to about 2^(2*numCells),
+// so an entry flushed for lying 2^1022 below the largest of its row can outweigh it there once that nears 2^1000. 400 cells leaves about 2^200 for rounding and priors
+static const int maxBlockDPCells = 400;
+
+Pileup::Pileup() {}
+
+Pileup::Pileup(int numCells, boost::string_view row) : numCells(numCells) {
+    // Parses row into tokens, which are slices of row rather than copies
+    static thread_local vector<boost::string_view> tokens;
+    splitFields(row, '\t', tokens);
+    if (tokens.size() < 3*numCells+3) throw runtime_error("Pileup row has " + to_string(tokens.size()) + " columns, expected " + to_string(3*numCells+3));
     
-    seqID = tokens[0];
-    seqPos = stoi(tokens[1]);
-    boost::trim(tokens[2]);
+    seqID = tokens[0].to_string();
+    seqPos = parseInt(tokens[1]);
+    tokens[2] = trimView(tokens[2]);
     refBase = toupper(tokens[2][0]);
     
     cells.reserve(numCells);
     for (int i = 0; i < numCells; i++) {
-        cells.push_back(SingleCellPos(stoi(tokens[3*i+3]), tokens[3*i+4], tokens[3*i+5]));
+        cells.push_back(SingleCellPos(parseInt(tokens[3*i+3]), tokens[3*i+4], tokens[3*i+5]));
     }
 }
 
@@ -126,6 +137,26 @@ void Pileup::filterCellsWithRead() {
     numCells = cells.size(); // set numcells to be the number of cells with read
 }
 
+void Pileup::countDepths() {
+    // sets rawTotalDepth and rawRefDepth from the unsanitized bases
+    rawTotalDepth = totalDepth();
+    rawRefDepth = refDepth();
+}
+
+bool Pileup::prepare() {
+    // sanitizes bases, filters cells and sets the alt base. Returns false if no reads or no alt base are left
+    sanitizeBases();
+    filterCellsWithRead();
+    
+    // Another filtration, in case all reads are erased
+    if (!numCells) return false;
+    
+    // Find and set alternate base at positon. If alt base cannot be set, return
+    if (!setAltBase()) return false;
+    
+    prepared = true;
+    return true;
+}
 
 void Pileup::sanitizeBases() {
     // Removes ins/deletions, special symbols, and cleans up all bases. Also changes refbase to upper. Also converts to numbers. Returns the number of forward and backward strands for each base.
@@ -173,13 +204,15 @@ bool Pileup::setAltBase() {
     return maxfreq; // true if maxfreq > 0
 }
 
-vector<array<wrdouble, 3>> Pileup::computeLikelihoods(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout) {
+template<class T>
+vector<array<T, 3>> Pileup::computeLikelihoods(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout) {
     // computes likelihoods L(g=0, 1, 2) for each cell
-    vector<array<wrdouble, 3>> likelihoods;
+    vector<array<T, 3>> likelihoods;
+    likelihoods.reserve(cells.size());
     for (auto &cell: cells) {
         double collect0 = 1.0, collect1 = 1.0, collect2 = 1.0; // collects the products
         
-        wrdouble g0 = 1.0, g2 = 1.0, probNoADO = 1.0;
+        T g0 = 1.0, g2 = 1.0, probNoADO = 1.0;
         for (int i = 0; i < cell.numReads; i++) {
             // g = 0
             double probRead0 = genotypePriors[refBase][refBase][cell.bases[i]]; // likelihood of read given both refbase
@@ -207,79 +240,223 @@ vector<array<wrdouble, 3>> Pileup::computeLikelihoods(const array<array<array<do
         g2 *= collect2;
         probNoADO *= collect1;
         
-        wrdouble probADO = (g0+g2)/2.0;
-        wrdouble g1 = probADO * pDropout + probNoADO * (1-pDropout);
+        T probADO = (g0+g2)/2.0;
+        T g1 = probADO * pDropout + probNoADO * (1-pDropout);
         
-        likelihoods.push_back(array<wrdouble, 3>{g0, g1, g2});
+        likelihoods.push_back(array<T, 3>{g0, g1, g2});
     }
     
     return likelihoods;
 }
 
-vector<wrdouble> Pileup::computeDP(const vector<array<wrdouble, 3>>& likelihoods) {
-    // computes dp for h_j,l and returns the row for j = numCells
-    vector<vector<wrdouble>> mem;
-    mem.resize(likelihoods.size()); // j = [0, numCells) - 0-indexed
-    for (int j = 0; j < likelihoods.size(); j++) mem[j].resize(2*likelihoods.size()+1, wrdouble(0)); // row j: l = [0, 2j+2]
-    wrdouble wr2 = 2.0;
+void Pileup::computeDP(const vector<array<wrdouble, 3>>& likelihoods, int skip, vector<wrdouble>& dp) {
+    // computes dp for h_j,l over all cells but skip (-1 for none), and sets dp to the last row.
+    // Decided on all cells, so that the dp of a site and those of its genotypes are computed alike
+    if (likelihoods.size() > maxBlockDPCells) computeExactDP(likelihoods, skip, dp);
+    else computeBlockDP(likelihoods, skip, dp);
+}
+
+void Pileup::computeExactDP(const vector<array<wrdouble, 3>>& likelihoods, int skip, vector<wrdouble>& dp) {
+    // computes dp for h_j,l with an exponent for every entry, as the dp was first written, so no entry is flushed however far below the others it lies.
+    // Only the previous row is kept, in thread-local rows that keep their capacity from call to call
+    static thread_local vector<wrdouble> previousRow, currentRow;
+    int numRows = likelihoods.size() - (skip >= 0);
+    int width = 2*numRows+3; // each row starts two entries early, with 0 for l = -2 and -1
+    previousRow.assign(width, wrdouble(0.0));
+    currentRow.assign(width, wrdouble(0.0));
+    previousRow[2] = 1.0; // before the first cell, l = 0 with probability 1
+    const wrdouble wr2 = 2.0;
     
-    // Base case
-    mem[0][0] = likelihoods[0][0];
-    mem[0][1] = likelihoods[0][1] * wr2;
-    mem[0][2] = likelihoods[0][2];
+    int done = 0; // cells in previousRow
+    for (int j = 0; j < likelihoods.size(); j++) {
+        if (j == skip) continue;
+        const array<wrdouble, 3>& cell = likelihoods[j];
+        const wrdouble* previous = previousRow.data() + 2;
+        wrdouble* row = currentRow.data() + 2;
+        for (int l = 0; l <= 2*done+2; l++) row[l] = previous[l]*cell[0] + previous[l-1]*cell[1]*wr2 + previous[l-2]*cell[2];
+        swap(previousRow, currentRow);
+        done++;
+    }
+    dp.assign(previousRow.begin() + 2, previousRow.end());
+}
+
+void Pileup::computeBlockDP(const vector<array<wrdouble, 3>>& likelihoods, int skip, vector<wrdouble>& dp) {
+    // computes dp for h_j,l as computeExactDP, for at most maxBlockDPCells cells.
+    // Each row is a block of doubles with one exponent, in powers of wrdouble::base, renormalized once per row, so the inner loop is plain multiply-adds.
+    // Rescaling is by powers of 2, so the sums round as they would in wrdouble. Entries more than 2^1022 below the largest of their row are flushed to 0.
+    // Dividing by 2*numCells C l can lift an entry by up to 2^(2*numCells) against the largest, which maxBlockDPCells keeps far below that.
+    // h_j,0 is also used on its own, as the numerator of the probability of zero mutations, so its product is kept as a wrdouble on the side.
+    // Only the previous row is kept, in thread-local rows that keep their capacity from call to call
+    static thread_local vector<double> previousRow, currentRow;
+    int numRows = likelihoods.size() - (skip >= 0);
+    int width = 2*numRows+3; // each row starts two entries early, with 0 for l = -2 and -1
+    previousRow.assign(width, 0.0);
+    currentRow.assign(width, 0.0);
+    previousRow[2] = 1; // before the first cell, l = 0 with probability 1
     
-    // Recursive cases
-    for (int j = 1; j < likelihoods.size(); j++) {
-        mem[j][0] = mem[j-1][0]*likelihoods[j][0];
-        mem[j][1] = mem[j-1][1]*likelihoods[j][0] + mem[j-1][0]*likelihoods[j][1]*wr2;
-        for (int l = 2; l <= 2*j+2; l++) {
-            mem[j][l] = mem[j-1][l]*likelihoods[j][0] + mem[j-1][l-1]*likelihoods[j][1]*wr2 + mem[j-1][l-2]*likelihoods[j][2];
+    int previousExponent = 0;
+    wrdouble exactZero = 1.0; // h_j,0, the product of L(g=0)
+    int done = 0; // cells in previousRow
+    for (int j = 0; j < likelihoods.size(); j++) {
+        if (j == skip) continue;
+        // The likelihoods of the cell, scaled to the largest of them
+        const array<wrdouble, 3>& cell = likelihoods[j];
+        int top = max(max(cell[0].exponent, cell[1].exponent), cell[2].exponent);
+        double l0 = ldexp(cell[0].value, 64*(cell[0].exponent-top));
+        double l1 = ldexp(cell[1].value, 64*(cell[1].exponent-top));
+        double l2 = ldexp(cell[2].value, 64*(cell[2].exponent-top));
+        exactZero *= cell[0];
+        
+        const double* previous = previousRow.data() + 2;
+        double* row = currentRow.data() + 2;
+        double largest = 0;
+        for (int l = 0; l <= 2*done+2; l++) {
+            row[l] = previous[l]*l0 + previous[l-1]*l1*2.0 + previous[l-2]*l2;
+            largest = max(largest, row[l]);
         }
+        
+        // Renormalize so the largest entry lies in [1, base)
+        int shift = 0;
+        if (largest > 0) {
+            int exponent;
+            frexp(largest, &exponent); // largest < 2^exponent
+            shift = (exponent-1) >= 0 ? (exponent-1)/64 : -((64-exponent)/64);
+            if (shift) {
+                double factor = ldexp(1.0, -32*shift); // applied twice, as 2^(64 shift) can exceed double range
+                for (int l = 0; l <= 2*done+2; l++) row[l] = row[l]*factor*factor;
+            }
+        }
+        previousExponent += top + shift;
+        swap(previousRow, currentRow);
+        done++;
     }
     
-    return mem[likelihoods.size()-1]; // return the row for j = numCells
+    // The last row, as wrdouble
+    const double* last = previousRow.data() + 2;
+    dp.resize(2*numRows+1);
+    for (int l = 0; l <= 2*numRows; l++) {
+        dp[l] = wrdouble(last[l]);
+        if (last[l] != 0) dp[l].exponent += previousExponent;
+    }
+    dp[0] = exactZero;
 }
 
-vector<wrdouble> Pileup::computeAltLikelihoods(const vector<wrdouble>& dp) {
-    // computes alt count likelihoods, dividing each element i by 2*numCells C i
-    vector<wrdouble> combis = combi->getRow(2*numCells);
-    vector<wrdouble> altLikelihoods = dp;
-    for (int i = 0; i <= 2*numCells; i++) altLikelihoods[i] /= combis[i];
-    return altLikelihoods;
+void Pileup::computeDP(const vector<array<double, 3>>& likelihoods, int skip, vector<double>& dp) {
+    // computes dp for h_j,l in plain doubles, as the wrdouble computeDP. Only for likelihoods that pass dpFitsDouble,
+    // where the entries match those of the wrdouble computeDP bit for bit, except ones too small to change any sum they enter
+    static thread_local vector<double> previousRow, currentRow;
+    int numRows = likelihoods.size() - (skip >= 0);
+    int width = 2*numRows+3; // each row starts two entries early, with 0 for l = -2 and -1
+    previousRow.assign(width, 0.0);
+    currentRow.assign(width, 0.0);
+    previousRow[2] = 1; // before the first cell, l = 0 with probability 1
+    
+    int done = 0; // cells in previousRow
+    for (int j = 0; j < likelihoods.size(); j++) {
+        if (j == skip) continue;
+        double l0 = likelihoods[j][0], l1 = likelihoods[j][1], l2 = likelihoods[j][2];
+        const double* previous = previousRow.data() + 2;
+        double* row = currentRow.data() + 2;
+        for (int l = 0; l <= 2*done+2; l++) row[l] = previous[l]*l0 + previous[l-1]*l1*2.0 + previous[l-2]*l2;
+        swap(previousRow, currentRow);
+        done++;
+    }
+    dp.assign(previousRow.begin() + 2, previousRow.end());
 }
 
-wrdouble Pileup::computeZeroVarProb(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout) {
-    // Generate variant number prior array
-    vector<double> altCountPriors = genAltCountPriors(cellsWithRead());
+template<class T>
+void Pileup::computeAltLikelihoods(vector<T>& dp) {
+    // turns dp into alt count likelihoods in place, dividing each element i by 2*numCells C i
+    // The row only depends on its length, so it is rebuilt only when the number of cells with reads changes
+    static thread_local vector<wrdouble> combis;
+    if (combis.size() != 2*numCells+1) combi->getRow(2*numCells, combis);
+    for (int i = 0; i <= 2*numCells; i++) dp[i] /= T(combis[i]);
+}
+
+bool Pileup::likelihoodsFitDouble(const array<array<array<double, 4>, 4>, 4>& genotypePriors) {
+    // Each read multiplies a likelihood by q(1-p)/3 + (1-q)p, for its error probability q and a prior p of the genotype. That is linear in q,
+    // so over q in [smallest q, 1] it is smallest at one of the ends, and every likelihood of a cell is at least that bound to the power of its depth
+    int maxDepth = 0;
+    double minError = 1;
+    for (auto& cell: cells) {
+        maxDepth = max(maxDepth, cell.numReads);
+        for (double q: cell.qualities) minError = min(minError, q);
+    }
     
-    // Generate likelihoods L(g=0, 1, 2) for each cell
-    likelihoodsGlob = computeLikelihoods(genotypePriors, pDropout);
-//    printf("Likelihoods:\n");
-//    for (int i = 0; i < numCells; i++) {
-//        for (int j = 0; j < 3; j++) cout << likelihoodsGlob[i][j] << "\t";
-//        printf("\n");
-//    }
+    double minFactor = 1;
+    for (auto& genotype: {genotypePriors[refBase][refBase], genotypePriors[refBase][altBase], genotypePriors[altBase][altBase]}) {
+        for (double p: genotype) minFactor = min(minFactor, min(minError*(1-p)/3 + (1-minError)*p, (1-p)/3));
+    }
+    return minFactor > 0 && maxDepth*log2(minFactor) > -maxDoubleLikelihoodExponent;
+}
+
+bool Pileup::dpFitsDouble(const vector<array<double, 3>>& likelihoods) {
+    // The largest entry of every dp row is at least the product of the largest likelihood of each cell, and h_j,0 is the product of L(g=0).
+    // Keeping both far above the smallest double, and the number of cells low enough that 4^numCells and the combinations stay in range,
+    // keeps every dp entry, alt likelihood and genotype probability that can change the result a normal double
+    if (numCells > maxDoubleCells) return false;
+    int zeroExponent = 0, largestExponent = 0; // binary exponents of the two products, rounded down
+    for (auto& cell: likelihoods) {
+        zeroExponent += ilogb(cell[0]);
+        largestExponent += ilogb(max(max(cell[0], cell[1]), cell[2]));
+    }
+    return zeroExponent > -maxDoubleDPExponent && largestExponent > -maxDoubleDPExponent;
+}
+
+template<class T>
+T Pileup::computeZeroVarProb(const vector<array<T, 3>>& likelihoods, const vector<double>& altCountPriors, T& base) {
     // Generate dp
-    vector<wrdouble> dp = computeDP(likelihoodsGlob);
+    static thread_local vector<T> altLikelihoods; // the dp, then the alt likelihoods
+    computeDP(likelihoods, -1, altLikelihoods);
 //    printf("DP:\n");
-//    for (int i = 0; i < numCells*2+1; i++) cout << dp[i] << "\t";
+//    for (int i = 0; i < numCells*2+1; i++) cout << altLikelihoods[i] << "\t";
 //    cout << endl;
     
     // Generate alternate count likelihoods
-    vector<wrdouble> altLikelihoods = computeAltLikelihoods(dp);
+    computeAltLikelihoods(altLikelihoods);
 //    printf("Alt likelihoods:\n");
 //    for (int i = 0; i < numCells*2+1; i++) cout << altLikelihoods[i] << "\t";
 //    cout << endl;
     
     // Compute probability of mutation
-    probBase = 0.0;
+    base = 0.0;
     for (int i = 0; i <= 2*numCells; i++) {
-        probBase += altLikelihoods[i] * altCountPriors[i];
+        base += altLikelihoods[i] * altCountPriors[i];
     }
-    wrdouble probability = (altLikelihoods[0] * altCountPriors[0]) / probBase; 
+    T probability = (altLikelihoods[0] * altCountPriors[0]) / base;
     return probability;
 }
 
+wrdouble Pileup::computeZeroVarProb(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout) {
+    if (logSpace) return computeLogZeroVarProb(genotypePriors, pDropout);
+    
+    // Generate variant number prior array
+    vector<double> altCountPriors = genAltCountPriors(cellsWithRead());
+    
+    // Generate likelihoods L(g=0, 1, 2) for each cell
+    plainDouble = false;
+    if (adaptivePrecision && likelihoodsFitDouble(genotypePriors)) {
+        doubleLikelihoodsGlob = computeLikelihoods<double>(genotypePriors, pDropout);
+        // These are exactly the wrdouble likelihoods, so a site that turns out too extreme for the dp only converts them
+        likelihoodsGlob.clear();
+        likelihoodsGlob.reserve(doubleLikelihoodsGlob.size());
+        for (auto& cell: doubleLikelihoodsGlob) likelihoodsGlob.push_back(array<wrdouble, 3>{cell[0], cell[1], cell[2]});
+        plainDouble = dpFitsDouble(doubleLikelihoodsGlob);
+    } else likelihoodsGlob = computeLikelihoods<wrdouble>(genotypePriors, pDropout);
+//    printf("Likelihoods:\n");
+//    for (int i = 0; i < numCells; i++) {
+//        for (int j = 0; j < 3; j++) cout << likelihoodsGlob[i][j] << "\t";
+//        printf("\n");
+//    }
+    
+    if (plainDouble) {
+        wrdouble probability = computeZeroVarProb(doubleLikelihoodsGlob, altCountPriors, doubleProbBase);
+        probBase = doubleProbBase;
+        return probability;
+    }
+    return computeZeroVarProb(likelihoodsGlob, altCountPriors, probBase);
+}
+
 double Pileup::computeC(int l, int v) {
     // computes the C function
     return combi->getValue(l, v) * combi->getValue(2*numCells-l, 2-v) / combi->getValue(2*numCells, 2);
@@ -292,31 +469,27 @@ double Pileup::computeC(int l, int v) {
 //    }
 }
 
-vector<int> Pileup::computeGenotype() {
-    // computes the genotype of each cell, 0, 1 or 2
+template<class T>
+vector<int> Pileup::computeGenotypes(const vector<array<T, 3>>& likelihoods, T base) {
+    // computes the genotype of each cell with reads, 0, 1 or 2
     vector<double> altCountPriors = genAltCountPriors(numCells);
 //    printf("Alt count priors:\n");
 //    for (int i = 0; i <= numCells*2; i++) printf("%lf\t", altCountPriors[i]);
 //    printf("\n");
     
-//    cout << "ProbBase = " << probBase << endl;
+//    cout << "ProbBase = " << base << endl;
+    static thread_local vector<T> dp;
     vector<int> genotypes; genotypes.reserve(numCells);
     for (int i = 0; i < numCells; i++) {
-        // Build new likelihoods, by removing this cell
-        vector<array<wrdouble, 3>> newLikelihoods;
-        newLikelihoods.reserve(numCells-1);
-        for (int j = 0; j < numCells; j++) {
-            if (j != i) newLikelihoods.push_back(likelihoodsGlob[j]);
-        }
-        vector<wrdouble> dp;
-        if (numCells != 1) dp = computeDP(newLikelihoods);
+        // dp without this cell
+        if (numCells != 1) computeDP(likelihoods, i, dp);
         
 //        printf("\nCell %d\n", i);
 //        printf("DP:\n");
 //        for (wrdouble j: dp) cout << j << "\t";
 //        cout << endl;
         
-        wrdouble probs[3]; // probability of each genotype
+        T probs[3]; // probability of each genotype
         for (int j = 0; j < 3; j++) {
             probs[j] = 0.0;
             if (numCells != 1) {
@@ -329,16 +502,16 @@ vector<int> Pileup::computeGenotype() {
             } else probs[j] = altCountPriors[i]; // There aren't any other cells
             
 //            cout << "before multiply" << probs[j] << "\t";
-            probs[j] *= likelihoodsGlob[i][j];
+            probs[j] *= likelihoods[i][j];
 //            cout << "after multiply" << probs[j] << "\t";
-            probs[j] /= probBase;
+            probs[j] /= base;
 //            cout << probs[j] << "\t";
 //            cout << "finalprob: " << probs[j] << "\n";
         }
 //        cout << endl;
         
         int bestGenotype = -1;
-        wrdouble highestProb = 0;
+        T highestProb = 0;
         for (int j = 0; j < 3; j++) {
             if (probs[j] > highestProb) {
                 highestProb = probs[j];
@@ -348,6 +521,17 @@ vector<int> Pileup::computeGenotype() {
         genotypes.push_back(bestGenotype);
     }
     
+    return genotypes;
+}
+
+vector<int> Pileup::computeGenotype() {
+    // computes the genotype of each cell, 0, 1 or 2
+    if (logSpace) return expandGenotypes(computeLogGenotypes());
+    if (plainDouble) return expandGenotypes(computeGenotypes(doubleLikelihoodsGlob, doubleProbBase));
+    return expandGenotypes(computeGenotypes(likelihoodsGlob, probBase));
+}
+
+vector<int> Pileup::expandGenotypes(const vector<int>& genotypes) {
     // Add '-1' for cells with no reads
     vector<int> allGenotypes;
     int pos = 0; // position in genotypes
@@ -364,6 +548,118 @@ vector<int> Pileup::computeGenotype() {
 }
 
 
+vector<array<double, 3>> Pileup::computeLogLikelihoods(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout) {
+    // computes the logs of the likelihoods L(g=0, 1, 2) for each cell. Products of 30 reads stay within double range, so only their logs are summed
+    vector<array<double, 3>> likelihoods;
+    likelihoods.reserve(cells.size());
+    double logDropout = logSpace::safeLog(pDropout), logNoDropout = logSpace::safeLog(1-pDropout);
+    for (auto &cell: cells) {
+        double collect0 = 1.0, collect1 = 1.0, collect2 = 1.0; // collects the products
+        double g0 = 0, g2 = 0, probNoADO = 0;
+        for (int i = 0; i < cell.numReads; i++) {
+            double quality = cell.qualities[i];
+            double probRead0 = genotypePriors[refBase][refBase][cell.bases[i]];
+            double probRead1 = genotypePriors[refBase][altBase][cell.bases[i]];
+            double probRead2 = genotypePriors[altBase][altBase][cell.bases[i]];
+            collect0 *= quality*(1-probRead0)/3 + (1-quality)*probRead0;
+            collect1 *= quality*(1-probRead1)/3 + (1-quality)*probRead1;
+            collect2 *= quality*(1-probRead2)/3 + (1-quality)*probRead2;
+            if (!(i%30)) {
+                g0 += logSpace::safeLog(collect0);
+                probNoADO += logSpace::safeLog(collect1);
+                g2 += logSpace::safeLog(collect2);
+                collect0 = collect1 = collect2 = 1.0;
+            }
+        }
+        g0 += logSpace::safeLog(collect0);
+        g2 += logSpace::safeLog(collect2);
+        probNoADO += logSpace::safeLog(collect1);
+        
+        double probADO = logSpace::logSumExp(g0, g2, logSpace::logZero) - logSpace::ln2;
+        double g1 = logSpace::logSumExp(probADO + logDropout, probNoADO + logNoDropout, logSpace::logZero);
+        
+        likelihoods.push_back(array<double, 3>{g0, g1, g2});
+    }
+    return likelihoods;
+}
+
+void Pileup::computeLogDP(const vector<array<double, 3>>& logLikelihoods, int skip, vector<double>& row) {
+    // Keeps only the previous row. Rows start two entries early, with logZero for l = -2 and -1, so the inner loop has no edge cases
+    static thread_local vector<double> previous, next;
+    int n = logLikelihoods.size() - (skip >= 0);
+    previous.assign(2*n+3, logSpace::logZero);
+    next.assign(2*n+3, logSpace::logZero);
+    previous[2] = 0; // no cells: l = 0 with probability 1
+    
+    int done = 0; // cells in previous
+    for (int j = 0; j < logLikelihoods.size(); j++) {
+        if (j == skip) continue;
+        double l0 = logLikelihoods[j][0], l1 = logLikelihoods[j][1] + logSpace::ln2, l2 = logLikelihoods[j][2];
+        const double* in = previous.data() + 2;
+        double* out = next.data() + 2;
+        done++;
+        for (int l = 0; l <= 2*done; l++) out[l] = logSpace::logSumExp(in[l] + l0, in[l-1] + l1, in[l-2] + l2);
+        swap(previous, next);
+    }
+    row.assign(previous.begin() + 2, previous.end());
+}
+
+wrdouble Pileup::computeLogZeroVarProb(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout) {
+    // computes the probability of zero mutations given data, as computeZeroVarProb. likelihoodsGlob and probBase are set as well, for output
+    vector<double> altCountPriors = genAltCountPriors(cellsWithRead());
+    logLikelihoodsGlob = computeLogLikelihoods(genotypePriors, pDropout);
+    likelihoodsGlob.clear();
+    for (auto& cell: logLikelihoodsGlob) likelihoodsGlob.push_back(array<wrdouble, 3>{logSpace::toWrdouble(cell[0]), logSpace::toWrdouble(cell[1]), logSpace::toWrdouble(cell[2])});
+    
+    static thread_local vector<double> dp;
+    computeLogDP(logLikelihoodsGlob, -1, dp);
+    
+    // Alt count likelihoods, times their priors
+    static thread_local vector<wrdouble> combis; // row 2*numCells, as in computeAltLikelihoods
+    if (combis.size() != 2*numCells+1) combi->getRow(2*numCells, combis);
+    for (int i = 0; i <= 2*numCells; i++) dp[i] += logSpace::safeLog(altCountPriors[i]) - logSpace::fromWrdouble(combis[i]);
+    logProbBase = logSpace::logSumExp(dp.data(), 2*numCells+1);
+    probBase = logSpace::toWrdouble(logProbBase);
+    return logSpace::toWrdouble(dp[0] - logProbBase);
+}
+
+vector<int> Pileup::computeLogGenotypes() {
+    // computes the genotype of each cell with reads, as computeGenotype does with wrdouble
+    vector<double> altCountPriors = genAltCountPriors(numCells);
+    
+    // log(C(l, j) p(l)) for each l and genotype j
+    vector<array<double, 3>> weights(2*numCells+1);
+    for (int l = 0; l <= 2*numCells; l++) {
+        for (int j = 0; j < 3; j++) weights[l][j] = logSpace::safeLog(computeC(l, j)*altCountPriors[l]);
+    }
+    
+    static thread_local vector<double> dp, terms;
+    vector<int> genotypes; genotypes.reserve(numCells);
+    for (int i = 0; i < numCells; i++) {
+        // dp without this cell
+        if (numCells != 1) computeLogDP(logLikelihoodsGlob, i, dp);
+        
+        int bestGenotype = -1;
+        double highestProb = logSpace::logZero/2; // below this, the probability is 0
+        for (int j = 0; j < 3; j++) {
+            double prob;
+            if (numCells != 1) {
+                terms.resize(2*numCells-1);
+                for (int l = j; l <= 2*numCells-2+j; l++) terms[l-j] = dp[l-j] + weights[l][j];
+                prob = logSpace::logSumExp(terms.data(), terms.size());
+            } else prob = logSpace::safeLog(altCountPriors[i]); // There aren't any other cells
+            prob += logLikelihoodsGlob[i][j] - logProbBase;
+            
+            if (prob > highestProb) {
+                highestProb = prob;
+                bestGenotype = j;
+            }
+        }
+        genotypes.push_back(bestGenotype);
+    }
+    return genotypes;
+}
+
 double Pileup::computeWilcoxon() {
     // computes the Mann-Whitney-Wilcoxon test
     vector<double> ref, alt;
@@ -14,6 +14,8 @@
 #include "combination.hpp"
 #include "phred.hpp"
 
+#include <boost/utility/string_view.hpp>
+
 #include <stdio.h>
 #include <string>
 #include <vector>
@@ -30,17 +32,32 @@ struct Pileup {
     int seqPos; // position in sequence (starting from 1)
     char refBase; // reference base at position
     char altBase; // alternate base at position
+    vector<char> storage; // bases and qualities for sites built directly from alignments; cells point into it
     vector<SingleCellPos> cells; // data for individual cell reads
     vector<SingleCellPos> allCells; // data for all cells, an archived version of cells
     array<array<int, 2>, 4> strandCount; // number of forward and backward strands for each base.
     
+    bool prepared = false; // whether bases are sanitized, cells filtered and altBase set, as for sites loaded from a site cache
+    int rawTotalDepth = 0; // no. of reads before sanitizing, as used by the prefilter
+    int rawRefDepth = 0; // no. of reads matching reference base before sanitizing, as used by the prefilter
+    
     const Combination* combi; // computes nCr, as a row of nC0...nCn
     const Phred* phred; // computes phred quality scores
     
     vector<array<wrdouble, 3>> likelihoodsGlob; // Likelihoods, saved from zeroVarProb for use in genotyping
     wrdouble probBase; // base, sum0_2m p(D|l)p(l) 
     
-    Pileup(int numCells, string& row);
+    bool logSpace = false; // whether computeZeroVarProb and computeGenotype work on logarithms (log_space.hpp) instead of wrdouble
+    vector<array<double, 3>> logLikelihoodsGlob; // natural logs of likelihoodsGlob, in log space
+    double logProbBase; // natural log of probBase, in log space
+    
+    bool adaptivePrecision = false; // whether computeZeroVarProb uses plain doubles for sites where they can not underflow, and wrdouble only for the others
+    bool plainDouble = false; // whether this site was computed in plain doubles, set by computeZeroVarProb
+    vector<array<double, 3>> doubleLikelihoodsGlob; // likelihoodsGlob as plain doubles, if plainDouble
+    double doubleProbBase; // probBase as a plain double, if plainDouble
+    
+    Pileup(); // empty site, filled in by readers that build sites directly
+    Pileup(int numCells, boost::string_view row); // parses row; cells point into row, which must outlive the pileup
     
     void print(string filename = "", bool quality = false); // prints bases and qualities for debugging, and appends to file if specified
     
@@ -57,6 +74,8 @@ struct Pileup {
     void sanitizeBases(); // removes ins/deletions, special symbols, and cleans up all bases. Also changes refbase to upper. Returns the number of forward and backward strands for each base.
     void computeQualities(); // converts the quality score string into decimal scores
     void filterCellsWithRead(); // archives cells to allCells, and filters cells for only those with reads
+    void countDepths(); // sets rawTotalDepth and rawRefDepth from the unsanitized bases
+    bool prepare(); // sanitizes bases, filters cells and sets the alt base. Returns false if no reads or no alt base are left
     
     array<int, 4> baseFreq(); // gets frequencies of each base - A, C, T, G
     bool setAltBase(); // sets the alternate base for position
@@ -64,12 +83,26 @@ struct Pileup {
     void convertBasesToInt(); // converts all bases to integers: A=0, C=1, T=2, G=3, without changing data structure. Acts on cells and refbase/altbase
 
     
-    vector<array<wrdouble, 3>> computeLikelihoods(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout); // computes likelihoods L(g=0, 1, 2) for each cell
-    vector<wrdouble> computeDP(const vector<array<wrdouble, 3>>& likelihoods); // computes dp for h_j,l and returns the row for j = numCells
-    vector<wrdouble> computeAltLikelihoods(const vector<wrdouble>& dp); // computes alt count likelihoods, dividing each element i by 2*numCells C i
+    // The kernels are templates on the number type, wrdouble or double. Where no value underflows, both round every operation alike
+    template<class T> vector<array<T, 3>> computeLikelihoods(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout); // computes likelihoods L(g=0, 1, 2) for each cell
+    void computeDP(const vector<array<wrdouble, 3>>& likelihoods, int skip, vector<wrdouble>& dp); // computes dp for h_j,l over all cells but skip (-1 for none). Sets dp to the last row
+    void computeExactDP(const vector<array<wrdouble, 3>>& likelihoods, int skip, vector<wrdouble>& dp); // computeDP with an exponent for every entry, for large cohorts
+    void computeBlockDP(const vector<array<wrdouble, 3>>& likelihoods, int skip, vector<wrdouble>& dp); // computeDP with one exponent per row, for at most maxBlockDPCells cells
+    void computeDP(const vector<array<double, 3>>& likelihoods, int skip, vector<double>& dp); // computeDP in plain doubles, without renormalizing
+    template<class T> void computeAltLikelihoods(vector<T>& dp); // turns dp into alt count likelihoods in place, dividing each element i by 2*numCells C i
+    template<class T> T computeZeroVarProb(const vector<array<T, 3>>& likelihoods, const vector<double>& altCountPriors, T& base); // computes the probability of zero mutations from the likelihoods, and sets base
     wrdouble computeZeroVarProb(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout); // computes the probability of zero mutations given data
+    bool likelihoodsFitDouble(const array<array<array<double, 4>, 4>, 4>& genotypePriors); // checks from the depth and the smallest error probability of the cells that no likelihood underflows a double
+    bool dpFitsDouble(const vector<array<double, 3>>& likelihoods); // checks from the likelihoods that no dp or genotype value that matters underflows or overflows a double
     double computeC(int l, int v); // computes the C function
+    template<class T> vector<int> computeGenotypes(const vector<array<T, 3>>& likelihoods, T base); // computes the genotype of each cell with reads from its likelihoods and probBase
     vector<int> computeGenotype(); // computes the genotype of each cell, 0, 1 or 2. -1 if the cell has no reads
+    vector<int> expandGenotypes(const vector<int>& genotypes); // adds -1 for the cells without reads to the genotypes of cells
+    
+    vector<array<double, 3>> computeLogLikelihoods(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout); // computeLikelihoods in log space
+    void computeLogDP(const vector<array<double, 3>>& logLikelihoods, int skip, vector<double>& row); // computeDP in log space, over all cells but skip (-1 for none). Sets row to the last row
+    wrdouble computeLogZeroVarProb(const array<array<array<double, 4>, 4>, 4>& genotypePriors, double pDropout); // computeZeroVarProb in log space
+    vector<int> computeLogGenotypes(); // the genotypes of the cells with reads, in log space
     
     double computeWilcoxon(); // computes the Mann-Whitney-Wilcoxon U-test
     double qualityByDepth(const double& quality, const vector<int>& genotype); // computes QualByDepth, quality divided by the number of reads in cells with mutation
@@ -0,0 +1,151 @@
+//
+//  pileup_index.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "pileup_index.hpp"
+#include "utility.hpp"
+
+#include <boost/algorithm/string.hpp>
+
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+bool pileupIndex::Region::contains(boost::string_view row) const {
+    // Reads the sequence name and position from the first two columns of row
+    size_t nameEnd = row.find('\t');
+    if (nameEnd == boost::string_view::npos || row.substr(0, nameEnd) != seqID) return false;
+    size_t posEnd = row.find('\t', nameEnd+1);
+    if (posEnd == boost::string_view::npos) return false;
+    int pos = utility::parseInt(row.substr(nameEnd+1, posEnd-nameEnd-1));
+    return pos >= start && pos <= end;
+}
+
+string pileupIndex::indexFilename(string pileupFilename) {
+    return pileupFilename + ".mvi";
+}
+
+static bool fileStats(string filename, long long& size, long long& mtime) {
+    // gets size and modification time of filename
+    struct stat info;
+    if (stat(filename.c_str(), &info) < 0) return false;
+    size = info.st_size;
+    mtime = info.st_mtime;
+    return true;
+}
+
+void pileupIndex::build(string pileupFilename, int chunkRows) {
+    // Reads the pileup once, starting an entry every chunkRows rows and wherever the sequence name changes
+    if (chunkRows < 1) throw invalid_argument("Rows per chunk must be positive");
+    FILE* pileup = fopen(pileupFilename.c_str(), "rb");
+    if (!pileup) throw runtime_error("Could not open pileup file " + pileupFilename);
+    int first = fgetc(pileup), second = fgetc(pileup);
+    if (first == 0x1f && second == 0x8b) {
+        fclose(pileup);
+        throw invalid_argument(pileupFilename + " is compressed; index bgzipped pileups with tabix -s 1 -b 2 -e 2 instead");
+    }
+    rewind(pileup);
+    
+    vector<Entry> entries;
+    int rowsInEntry = 0;
+    size_t offset = 0;
+    long rowIndex = 0;
+    char* line = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, pileup)) >= 0) {
+        boost::string_view row = utility::trimView(boost::string_view(line, length));
+        size_t rowOffset = offset;
+        offset += length;
+        if (!row.size()) continue;
+        
+        size_t nameEnd = row.find('\t');
+        size_t posEnd = row.find('\t', nameEnd == boost::string_view::npos ? row.size() : nameEnd+1);
+        if (posEnd == boost::string_view::npos) {
+            free(line);
+            fclose(pileup);
+            throw runtime_error("Pileup row " + to_string(rowIndex+1) + " has too few columns");
+        }
+        boost::string_view seqID = row.substr(0, nameEnd);
+        int pos = utility::parseInt(row.substr(nameEnd+1, posEnd-nameEnd-1));
+        
+        if (!entries.size() || rowsInEntry == chunkRows || entries.back().seqID != seqID) {
+            entries.push_back({seqID.to_string(), pos, pos, rowOffset, rowIndex, 0});
+            rowsInEntry = 0;
+        }
+        Entry& entry = entries.back();
+        entry.minPos = min(entry.minPos, pos);
+        entry.maxPos = max(entry.maxPos, pos);
+        entry.numRows++;
+        rowsInEntry++;
+        rowIndex++;
+    }
+    free(line);
+    fclose(pileup);
+    
+    long long size, mtime;
+    fileStats(pileupFilename, size, mtime);
+    ofstream index(indexFilename(pileupFilename));
+    if (!index) throw runtime_error("Could not create index " + indexFilename(pileupFilename));
+    index << "##monovar-index\t" << size << "\t" << mtime << "\t" << chunkRows << "\t" << rowIndex << "\n";
+    for (Entry& entry: entries) index << entry.seqID << "\t" << entry.minPos << "\t" << entry.maxPos << "\t" << entry.offset << "\t" << entry.rowIndex << "\n";
+    if (!index.good()) throw runtime_error("Could not write index " + indexFilename(pileupFilename));
+    fprintf(stderr, "Indexed %ld rows in %d chunks\n", rowIndex, (int) entries.size());
+}
+
+bool pileupIndex::load(string pileupFilename, vector<Entry>& entries) {
+    // Reads the index, checking it was built from the pileup as it is now
+    ifstream index(indexFilename(pileupFilename));
+    if (!index) return false;
+    
+    string header;
+    long long indexedSize, indexedMtime, size, mtime, totalRows;
+    int chunkRows;
+    if (!getline(index, header) || sscanf(header.c_str(), "##monovar-index\t%lld\t%lld", &indexedSize, &indexedMtime) != 2) throw runtime_error(indexFilename(pileupFilename) + " is not a monovar index");
+    if (sscanf(header.c_str(), "##monovar-index\t%lld\t%lld\t%d\t%lld", &indexedSize, &indexedMtime, &chunkRows, &totalRows) != 4 || !fileStats(pileupFilename, size, mtime) || size != indexedSize || mtime != indexedMtime) {
+        fprintf(stderr, "Ignoring %s, which is older than the pileup; rerun monovar index\n", indexFilename(pileupFilename).c_str());
+        return false;
+    }
+    
+    entries.clear();
+    string line;
+    vector<string> tokens;
+    while (getline(index, line)) {
+        if (!line.size()) continue;
+        boost::split(tokens, line, boost::is_any_of("\t"));
+        if (tokens.size() != 5) throw runtime_error(indexFilename(pileupFilename) + " is corrupt");
+        entries.push_back({tokens[0], stoi(tokens[1]), stoi(tokens[2]), (size_t) stoull(tokens[3]), stol(tokens[4]), 0});
+    }
+    for (size_t i = 0; i < entries.size(); i++) entries[i].numRows = (i+1 < entries.size() ? entries[i+1].rowIndex : totalRows) - entries[i].rowIndex;
+    return true;
+}
+
+pileupIndex::Region pileupIndex::parseRegion(string region) {
+    // Parses chr, chr:start or chr:start-end; positions are 1-based and inclusive
+    Region parsed = {region, 0, INT_MAX};
+    size_t colon = region.rfind(':');
+    if (colon == string::npos) return parsed;
+    
+    parsed.seqID = region.substr(0, colon);
+    string range = region.substr(colon+1);
+    size_t dash = range.find('-');
+    try {
+        parsed.start = stoi(range.substr(0, dash));
+        if (dash != string::npos && dash+1 < range.size()) parsed.end = stoi(range.substr(dash+1));
+    } catch (logic_error&) {
+        throw invalid_argument("Could not parse region " + region);
+    }
+    if (parsed.end < parsed.start) throw invalid_argument("Region " + region + " ends before it starts");
+    return parsed;
+}
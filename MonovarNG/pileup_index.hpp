@@ -0,0 +1,50 @@
+//
+//  pileup_index.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef pileup_index_hpp
+#define pileup_index_hpp
+
+#include <boost/utility/string_view.hpp>
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A sidecar index for plain-text pileups, written next to the pileup as <pileup>.mvi. It splits the pileup into chunks of rows, so the chunks can be read in parallel, by shard or by region.
+// The index is text: a header line "##monovar-index<TAB>pileup size<TAB>pileup mtime<TAB>rows per chunk<TAB>total rows", then one line per chunk with
+// sequence name, lowest and highest position, byte offset and row number of its first row. A chunk ends after the given number of rows or where the sequence name changes
+
+namespace pileupIndex {
+    struct Entry {
+        // A chunk of rows, all on one sequence
+        string seqID; // sequence name of the rows
+        int minPos, maxPos; // lowest and highest position of the rows
+        size_t offset; // byte offset of the first row
+        long rowIndex; // row number of the first row, counting non-blank lines from 0
+        long numRows; // number of rows
+    };
+    
+    struct Region {
+        // A region to call, from a string chr, chr:start or chr:start-end
+        string seqID;
+        int start, end; // inclusive range of positions
+        
+        bool contains(boost::string_view row) const; // checks whether the pileup row lies in the region
+    };
+    
+    string indexFilename(string pileupFilename); // name of the index of pileupFilename
+    
+    void build(string pileupFilename, int chunkRows); // writes the index of pileupFilename, with a chunk every chunkRows rows
+    
+    bool load(string pileupFilename, vector<Entry>& entries); // reads the index of pileupFilename into entries. Returns false if there is no index, or it is older than the pileup
+    
+    Region parseRegion(string region); // parses chr, chr:start or chr:start-end
+}
+
+#endif /* pileup_index_hpp */
@@ -0,0 +1,243 @@
+//
+//  pileup_reader.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "pileup_reader.hpp"
+#include "utility.hpp"
+
+#include <htslib/hts.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+PileupReader::PileupReader(string filename, size_t queueSize, int ioThreads, vector<string> regions): StreamingRowSource(queueSize), regions(regions) {
+    if (filename == "-") {
+        // BGZF fills whole blocks before returning a line, which would hold rows back on a slow pipe
+        if (regions.size()) throw invalid_argument("Regions can not be read from stdin");
+        fprintf(stderr, "Reading from stdin\n");
+        pipeFile = stdin;
+        start();
+        return;
+    }
+    
+    fprintf(stderr, "Reading from %s\n", filename.c_str());
+    pileupFile = bgzf_open(filename.c_str(), "r"); // also reads plain and gzip files
+    if (!pileupFile) throw runtime_error("Could not open pileup file " + filename);
+    
+    if (regions.size()) {
+        index = tbx_index_load(filename.c_str());
+        if (!index) throw runtime_error("Regions need a bgzipped pileup indexed with tabix -s 1 -b 2 -e 2, but no index was found for " + filename);
+    }
+    
+    // Only BGZF blocks can be decompressed in parallel
+    if (bgzf_compression(pileupFile) == bgzf && ioThreads > 0) {
+        decompressPool = hts_tpool_init(ioThreads);
+        if (!decompressPool || bgzf_thread_pool(pileupFile, decompressPool, 0) < 0) throw runtime_error("Could not start decompression threads");
+    }
+    start();
+}
+
+PileupReader::~PileupReader() {
+    stop();
+    if (regionIter) hts_itr_destroy(regionIter);
+    if (index) tbx_destroy(index);
+    if (pileupFile) bgzf_close(pileupFile);
+    if (decompressPool) hts_tpool_destroy(decompressPool); // after closing, as the file uses the pool
+    ks_free(&line);
+}
+
+int PileupReader::readLine() {
+    // Reads the next line into line. With regions, the index is used to seek to each region in turn
+    if (pipeFile) {
+        ssize_t length = getline(&line.s, &line.m, pipeFile); // returns as soon as a whole line is in, unlike a BGZF block read
+        if (length < 0) return ferror(pipeFile) ? -2 : -1;
+        line.l = length;
+        return length;
+    }
+    if (!regions.size()) return bgzf_getline(pileupFile, '\n', &line);
+    
+    while (true) {
+        if (!regionIter) {
+            if (nextRegion == regions.size()) return -1;
+            string& region = regions[nextRegion++];
+            regionIter = tbx_itr_querys(index, region.c_str());
+            if (!regionIter) {
+                fprintf(stderr, "Skipping region %s, which is not in the pileup\n", region.c_str());
+                continue;
+            }
+        }
+        int ret = hts_itr_next(pileupFile, regionIter, &line, index);
+        if (ret >= 0) return line.l;
+        if (ret < -1) return ret;
+        hts_itr_destroy(regionIter); // end of region
+        regionIter = nullptr;
+    }
+}
+
+bool PileupReader::readRow(Row& row) {
+    // Reads the next line, skipping blank ones
+    int length;
+    while ((length = readLine()) >= 0) {
+        boost::string_view text = utility::trimView(boost::string_view(line.s, length));
+        if (text.size()) {
+            row.buffer.assign(text.data(), text.size());
+            return true;
+        }
+    }
+    if (length < -1) throw runtime_error("Error while reading pileup file");
+    return false;
+}
+
+MappedPileupReader::MappedPileupReader(string filename) {
+    fprintf(stderr, "Mapping %s\n", filename.c_str());
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Could not open pileup file " + filename);
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        throw runtime_error("Could not stat pileup file " + filename);
+    }
+    size = info.st_size;
+    if (size) { // empty files cannot be mapped
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Could not map pileup file " + filename);
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = (const char*) mapped;
+    }
+    close(fd); // the mapping stays valid
+}
+
+MappedPileupReader::~MappedPileupReader() {
+    if (data) munmap((void*) data, size);
+}
+
+bool MappedPileupReader::nextLine(size_t& offset, size_t end, boost::string_view& line) const {
+    // Finds the next non-blank line at or after offset and before end
+    while (offset < end) {
+        const char* start = data + offset;
+        const char* newline = (const char*) memchr(start, '\n', end - offset);
+        size_t length = newline ? newline - start : end - offset;
+        offset += length + 1;
+        
+        // Trim, as for streamed rows
+        while (length && isspace((unsigned char) *start)) {
+            start++;
+            length--;
+        }
+        while (length && isspace((unsigned char) start[length-1])) length--;
+        if (!length) continue;
+        
+        line = boost::string_view(start, length);
+        return true;
+    }
+    return false;
+}
+
+bool MappedPileupReader::next(Row& row) {
+    // Finds the next non-blank line after cursor; only the newline search happens under the lock
+    lock_guard<mutex> lock(cursorMutex);
+    if (!nextLine(cursor, size, row.text)) return false;
+    row.index = row.order = numRows++;
+    return true;
+}
+
+long MappedPileupReader::rowsRead() {
+    lock_guard<mutex> lock(cursorMutex);
+    return numRows;
+}
+
+static atomic<long> numIndexedReaders(0); // source of reader IDs
+
+IndexedPileupReader::IndexedPileupReader(string filename, const vector<pileupIndex::Entry>& entries, vector<string> regionNames, int shard, int numShards): MappedPileupReader(filename), nextChunk(0), numRows(0), readerID(numIndexedReaders++) {
+    for (string& name: regionNames) regions.push_back(pileupIndex::parseRegion(name));
+    
+    for (size_t i = 0; i < entries.size(); i++) {
+        const pileupIndex::Entry& entry = entries[i];
+        size_t end = i+1 < entries.size() ? entries[i+1].offset : size;
+        if ((unsigned long long) entry.offset * numShards / max(size, (size_t) 1) != shard) continue; // shards are contiguous byte ranges, split at chunk boundaries
+        if (!regions.size()) chunks.push_back({entry.offset, end, entry.rowIndex, entry.numRows, 0, -1});
+    }
+    
+    // Regions are read in the order given, each from the chunks that overlap it
+    for (int r = 0; r < regions.size(); r++) {
+        bool found = false;
+        for (size_t i = 0; i < entries.size(); i++) {
+            const pileupIndex::Entry& entry = entries[i];
+            if (entry.seqID != regions[r].seqID) continue;
+            found = true;
+            if (entry.maxPos < regions[r].start || entry.minPos > regions[r].end) continue;
+            if ((unsigned long long) entry.offset * numShards / max(size, (size_t) 1) != shard) continue;
+            size_t end = i+1 < entries.size() ? entries[i+1].offset : size;
+            chunks.push_back({entry.offset, end, entry.rowIndex, entry.numRows, 0, r});
+        }
+        if (!found) fprintf(stderr, "Skipping region %s, which is not in the pileup\n", regionNames[r].c_str());
+    }
+    
+    // Every row of a chunk is handed out, so the order of its rows follows from the row counts of the chunks before it
+    long order = 0;
+    for (Chunk& chunk: chunks) {
+        chunk.firstOrder = order;
+        order += chunk.numRows;
+    }
+}
+
+bool IndexedPileupReader::next(Row& row) {
+    // Continues through the chunk this thread claimed, claiming the next one when it runs out
+    struct ChunkCursor {
+        long readerID = -1; // reader the cursor belongs to
+        size_t chunk; // claimed chunk
+        size_t offset; // next byte to read in chunk
+        long rowIndex; // row number of the next row
+    };
+    static thread_local ChunkCursor position;
+    
+    while (true) {
+        if (position.readerID == readerID) {
+            Chunk& chunk = chunks[position.chunk];
+            boost::string_view line;
+            while (nextLine(position.offset, chunk.end, line)) {
+                row.index = position.rowIndex++;
+                row.order = chunk.firstOrder + (row.index - chunk.firstRow);
+                if (chunk.region >= 0 && !regions[chunk.region].contains(line)) row.text = boost::string_view(); // outside the region, but keeps its place in the order
+                else {
+                    row.text = line;
+                    numRows++;
+                }
+                return true;
+            }
+        }
+        
+        size_t claimed = nextChunk++;
+        if (claimed >= chunks.size()) return false;
+        position.readerID = readerID;
+        position.chunk = claimed;
+        position.offset = chunks[claimed].begin;
+        position.rowIndex = chunks[claimed].firstRow;
+    }
+}
+
+long IndexedPileupReader::orderSpan() {
+    long span = 0;
+    for (Chunk& chunk: chunks) span = max(span, chunk.numRows);
+    return span;
+}
+
+long IndexedPileupReader::rowsRead() {
+    return numRows;
+}
@@ -0,0 +1,86 @@
+//
+//  pileup_reader.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef pileup_reader_hpp
+#define pileup_reader_hpp
+
+#include "row_source.hpp"
+#include "pileup_index.hpp"
+
+#include <htslib/bgzf.h>
+#include <htslib/tbx.h>
+#include <htslib/kstring.h>
+#include <htslib/thread_pool.h>
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+class PileupReader: public StreamingRowSource {
+    // Streams rows of a plain, gzip or bgzip compressed pileup file, or of plain text on stdin, to the workers
+    BGZF* pileupFile = nullptr;
+    FILE* pipeFile = nullptr; // stdin, for the filename -. Read a line at a time, so each row is called as soon as it arrives
+    hts_tpool* decompressPool = nullptr; // decompresses BGZF blocks ahead of the reader, separate from the calling workers
+    kstring_t line = KS_INITIALIZE; // line buffer for bgzf_getline
+    
+    vector<string> regions; // regions to read, in order. Empty to read the whole file
+    tbx_t* index = nullptr; // tabix index, loaded when regions are given
+    hts_itr_t* regionIter = nullptr; // iterator over the current region
+    int nextRegion = 0; // index in regions of the next region to query
+    
+    int readLine(); // reads the next line of the file, or of the regions, into line. Returns its length, or -1 at the end
+    bool readRow(Row& row); // reads the next non-blank line
+public:
+    PileupReader(string filename, size_t queueSize, int ioThreads, vector<string> regions = vector<string>()); // opens filename and starts reading; at most queueSize rows are buffered, and BGZF input is decompressed on ioThreads threads. If regions are given, only rows within them are read, using the tabix index of filename
+    ~PileupReader();
+};
+
+class MappedPileupReader: public RowSource {
+    // Serves rows as slices of a memory-mapped pileup file, so row text is never copied
+    size_t cursor = 0; // offset of the first byte not yet handed out
+    long numRows = 0; // rows handed out so far
+    mutex cursorMutex; // guards cursor and numRows
+protected:
+    const char* data = nullptr; // start of mapped file
+    size_t size = 0; // length of mapped file
+    
+    bool nextLine(size_t& offset, size_t end, boost::string_view& line) const; // finds the next non-blank line starting at or after offset and before end, trimmed, and moves offset past it
+public:
+    MappedPileupReader(string filename); // maps filename into memory
+    ~MappedPileupReader();
+    
+    bool next(Row& row);
+    long rowsRead();
+};
+
+class IndexedPileupReader: public MappedPileupReader {
+    // Serves rows of a mapped plain-text pileup in chunks from its sidecar index. Each worker scans the byte range of the chunk it claimed, so only claiming a chunk is shared
+    struct Chunk {
+        size_t begin, end; // byte range of the rows
+        long firstRow; // row number of the first row
+        long numRows; // number of rows
+        long firstOrder; // place of the first row in the output order
+        int region; // index in regions of the region rows must fall in, or -1 for all rows
+    };
+    vector<Chunk> chunks; // chunks to read, in order
+    vector<pileupIndex::Region> regions; // regions to read. Empty to read the whole file
+    atomic<size_t> nextChunk; // first chunk not yet claimed
+    atomic<long> numRows; // rows handed out so far
+    long readerID; // tells the thread-local chunk cursors of different readers apart
+public:
+    IndexedPileupReader(string filename, const vector<pileupIndex::Entry>& entries, vector<string> regions, int shard = 0, int numShards = 1); // maps filename and reads the chunks of entries that overlap regions and fall in the byte range of shard (of numShards)
+    
+    bool next(Row& row);
+    long rowsRead();
+    long orderSpan(); // a thread works through a whole chunk, so others can be a chunk ahead
+};
+
+#endif /* pileup_reader_hpp */
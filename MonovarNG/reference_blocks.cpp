@@ -0,0 +1,71 @@
+//
+//  reference_blocks.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "reference_blocks.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+ReferenceBlockWriter::ReferenceBlockWriter(string filename): filename(filename), file(filename) {
+    if (!file) throw runtime_error("Could not create reference block file " + filename);
+}
+
+ReferenceBlockWriter::~ReferenceBlockWriter() {
+    // Best effort, as a destructor can not throw: errors are only thrown from an explicit close
+    try {
+        close();
+    } catch (exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+void ReferenceBlockWriter::writeHeader(string referenceFilename) {
+    file << "##fileformat=VCFv4.1\n";
+    file << "##source=MonoVar\n";
+    file << "##reference=file:" << referenceFilename << "\n";
+    file << "##ALT=<ID=*,Description=\"Any allele other than the reference\">\n";
+    file << "##INFO=<ID=END,Number=1,Type=Integer,Description=\"Last position of the block of non-variant sites\">\n";
+    file << "##INFO=<ID=MinDP,Number=1,Type=Integer,Description=\"Lowest read depth of the sites in the block\">\n";
+    file << "##INFO=<ID=PF,Number=1,Type=Integer,Description=\"Why the sites were not called: 0 evaluated and not variant, 1 no alt reads, 2 too few alt reads, 3 bad reference base, 4 depth of 10 or less, 5 no usable reads after filtering\">\n";
+    file << "##INFO=<ID=MinRGQ,Number=1,Type=Integer,Description=\"Lowest phred-scaled confidence that a site of the block is not variant, capped at 99. Only for evaluated sites\">\n";
+    file << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\n";
+}
+
+void ReferenceBlockWriter::add(const ReferenceSite& site) {
+    // Sites join the open block if they follow it directly and were dropped for the same reason, with confidence in the same band
+    if (first.seqID.size() && site.seqID == first.seqID && site.pos == end+1 && site.filter == first.filter && site.confidence/10 == first.confidence/10) {
+        end = site.pos;
+        minDepth = min(minDepth, site.depth);
+        minConfidence = min(minConfidence, site.confidence);
+        return;
+    }
+    flushBlock();
+    first = site;
+    end = site.pos;
+    minDepth = site.depth;
+    minConfidence = site.confidence;
+}
+
+void ReferenceBlockWriter::flushBlock() {
+    if (!first.seqID.size()) return;
+    file << first.seqID << "\t" << first.pos << "\t.\t" << first.ref << "\t<*>\t.\t.\tEND=" << end << ";MinDP=" << minDepth << ";PF=" << first.filter;
+    if (minConfidence >= 0) file << ";MinRGQ=" << minConfidence;
+    file << "\n";
+    first.seqID.clear();
+}
+
+void ReferenceBlockWriter::close() {
+    if (!file.is_open()) return;
+    flushBlock();
+    file.close();
+    if (file.fail()) throw runtime_error("Could not write to " + filename);
+}
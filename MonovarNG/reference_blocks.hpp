@@ -0,0 +1,51 @@
+//
+//  reference_blocks.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef reference_blocks_hpp
+#define reference_blocks_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <fstream>
+
+using namespace std;
+
+// Reference blocks record the sites that were seen but not called, so that batches of cells called at different times can be merged without their pileups.
+// They are written as a sites-only vcf in the style of gVCF: one row per run of consecutive non-variant sites, with ALT <*> and the INFO fields
+//   END: last position of the run, MinDP: lowest read depth, PF: why the sites were not called (0: evaluated by the model, 1-4: prefilterSite reason, 5: no usable reads after filtering),
+//   MinRGQ: for evaluated sites, the lowest phred-scaled confidence that a site is not variant, capped at 99
+// A run ends at a gap in positions, a change of PF, or a change of confidence band (0-9, 10-19, ..., 90-99)
+
+struct ReferenceSite {
+    // A site that was not called
+    string seqID; // empty where a row has no site, e.g. it is called or malformed
+    int pos = 0;
+    char ref = 'N'; // reference base, as a letter
+    int depth = 0; // reads at the site, before filtering
+    int filter = 0; // PF, why the site was not called
+    int confidence = -1; // RGQ for evaluated sites, -1 otherwise
+};
+
+class ReferenceBlockWriter {
+    // Collects non-variant sites, given in input order, into blocks
+    string filename;
+    ofstream file;
+    ReferenceSite first; // first site of the open block, seqID empty if no block is open
+    int end, minDepth, minConfidence; // summary of the open block
+    
+    void flushBlock(); // writes the open block
+public:
+    ReferenceBlockWriter(string filename); // creates filename
+    ~ReferenceBlockWriter();
+    
+    void writeHeader(string referenceFilename); // writes the header, describing the INFO fields
+    void add(const ReferenceSite& site); // extends the open block with site, or writes it and starts a new one
+    void close(); // writes the last block and flushes the file
+};
+
+#endif /* reference_blocks_hpp */
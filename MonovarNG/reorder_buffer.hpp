@@ -0,0 +1,83 @@
+//
+//  reorder_buffer.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef reorder_buffer_hpp
+#define reorder_buffer_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+template<class T>
+class ReorderBuffer {
+    // Takes results that finish out of order, numbered 0, 1, 2, ... without gaps, and releases them in that order. At most capacity results wait at once
+    size_t capacity; // size of the window of orders that can be submitted
+    vector<T> slots; // results waiting, at order % capacity
+    vector<char> filled; // whether each slot holds a result
+    long nextOrder = 0; // order of the next result to release
+    bool closed = false; // set once all results are submitted
+    bool aborted = false; // set when a worker or the consumer fails, to release everyone waiting
+    
+    mutex bufferMutex;
+    condition_variable windowMoved; // signalled when a result is released
+    condition_variable nextReady; // signalled when the next result arrives, or the buffer is closed or aborted
+    
+public:
+    ReorderBuffer(size_t capacity): capacity(capacity ? capacity : 1), slots(this->capacity), filled(this->capacity, 0) {}
+    
+    bool submit(long order, T&& result) {
+        // stores the result for order, waiting while order is too far ahead of the next one to release. Returns false if the buffer was aborted
+        unique_lock<mutex> lock(bufferMutex);
+        windowMoved.wait(lock, [&]{ return aborted || order < nextOrder + (long) capacity; });
+        if (aborted) return false;
+        slots[order % capacity] = std::move(result);
+        filled[order % capacity] = 1;
+        bool isNext = order == nextOrder;
+        lock.unlock();
+        if (isNext) nextReady.notify_one();
+        return true;
+    }
+    
+    bool pop(T& result) {
+        // takes the next result in order, waiting until it arrives. Returns false once the buffer is closed and the results up to the first gap are taken, or if it was aborted
+        unique_lock<mutex> lock(bufferMutex);
+        size_t slot = nextOrder % capacity;
+        nextReady.wait(lock, [&]{ return aborted || closed || filled[slot]; });
+        if (aborted || !filled[slot]) return false;
+        result = std::move(slots[slot]);
+        slots[slot] = T();
+        filled[slot] = 0;
+        nextOrder++;
+        lock.unlock();
+        windowMoved.notify_all();
+        return true;
+    }
+    
+    void close() {
+        // marks all results as submitted
+        {
+            lock_guard<mutex> lock(bufferMutex);
+            closed = true;
+        }
+        nextReady.notify_all();
+    }
+    
+    void abort() {
+        // gives up: waiting submits and pops return false
+        {
+            lock_guard<mutex> lock(bufferMutex);
+            aborted = true;
+        }
+        windowMoved.notify_all();
+        nextReady.notify_all();
+    }
+};
+
+#endif /* reorder_buffer_hpp */
@@ -0,0 +1,57 @@
+//
+//  row_source.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "row_source.hpp"
+
+#include <string>
+
+using namespace std;
+
+StreamingRowSource::StreamingRowSource(size_t queueSize): queue(queueSize), numRows(0) {}
+
+StreamingRowSource::~StreamingRowSource() {
+    stop();
+}
+
+void StreamingRowSource::start() {
+    producer = thread(&StreamingRowSource::produce, this);
+}
+
+void StreamingRowSource::stop() {
+    queue.close(); // unblocks the producer if workers stopped early
+    if (producer.joinable()) producer.join();
+}
+
+void StreamingRowSource::produce() {
+    // Reads rows into queue until readRow runs out
+    try {
+        Row row;
+        while (readRow(row)) {
+            row.index = row.order = numRows;
+            if (!queue.push(move(row))) break; // source is shutting down
+            numRows++;
+            row = Row();
+        }
+    } catch (...) {
+        error = current_exception();
+    }
+    queue.close();
+}
+
+bool StreamingRowSource::next(Row& row) {
+    // Gets the next row, waiting for the producer if needed
+    if (queue.pop(row)) {
+        if (!row.site) row.text = row.buffer;
+        return true;
+    }
+    if (error) rethrow_exception(error);
+    return false;
+}
+
+long StreamingRowSource::rowsRead() {
+    return numRows;
+}
@@ -0,0 +1,63 @@
+//
+//  row_source.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef row_source_hpp
+#define row_source_hpp
+
+#include "pileup.hpp"
+#include "bounded_queue.hpp"
+
+#include <boost/utility/string_view.hpp>
+
+#include <stdio.h>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <exception>
+
+using namespace std;
+
+struct Row {
+    // A single row of pileup input, tagged with its place in the input
+    long index = -1; // row number in input, starting from 0
+    long order = -1; // place of the row among the rows the source hands out, from 0 without gaps. Output is written in this order
+    string buffer; // storage for rows that are read into memory, unused when rows are mapped
+    boost::string_view text; // contents of row, trimmed. Points into buffer or into a mapped file. Empty for rows handed out only to keep their place in the order, e.g. rows outside the requested regions
+    unique_ptr<Pileup> site; // set instead of text by sources that build sites directly, e.g. from alignments
+};
+
+class RowSource {
+    // Supplies pileup rows to the workers, in input order
+public:
+    virtual ~RowSource() {}
+    virtual bool next(Row& row) = 0; // gets the next row, returning false once input is exhausted. Safe to call from several threads
+    virtual long rowsRead() = 0; // number of rows handed out so far
+    virtual long orderSpan() { return 0; } // how far ahead in the order one thread can get while another still holds an earlier row; 0 for sources that hand out rows in order
+};
+
+class StreamingRowSource: public RowSource {
+    // Reads rows on a producer thread and hands them to the workers through a bounded queue, so memory stays flat and reading overlaps with computation
+    BoundedQueue<Row> queue; // rows read but not yet taken by a worker
+    thread producer; // reads rows into queue
+    exception_ptr error; // set if the producer failed
+    atomic<long> numRows; // rows read so far
+    
+    void produce(); // reads rows into queue until readRow runs out
+protected:
+    virtual bool readRow(Row& row) = 0; // reads the next row into row.buffer or row.site, returning false at end of input. Runs on the producer thread
+    void start(); // starts the producer. Called by subclasses once they are fully constructed
+    void stop(); // stops and joins the producer. Called by subclass destructors, before their members go away
+public:
+    StreamingRowSource(size_t queueSize); // at most queueSize rows are buffered
+    ~StreamingRowSource();
+    
+    bool next(Row& row);
+    long rowsRead();
+};
+
+#endif /* row_source_hpp */
@@ -8,37 +8,51 @@
 
 #include "single_cell_pos.hpp"
 #include "phred.hpp"
+#include "utility.hpp"
 
 #include <boost/algorithm/string.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <cctype>
+#include <cstdint>
 
 using namespace std;
 
-SingleCellPos::SingleCellPos(int numReads, string& bases, string& qualityString) {
-    // initializer sets default values
-    numReads = numReads;
-    bases = bases;
-    qualityString = qualityString;
+SingleCellPos::SingleCellPos(int numReads, boost::string_view bases, boost::string_view qualityString): numReads(numReads), bases(bases), qualityString(qualityString) {}
+
+SingleCellPos::SingleCellPos(const SingleCellPos& other) {
+    // copy constructor
+    *this = other;
+}
+
+SingleCellPos& SingleCellPos::operator=(const SingleCellPos& other) {
+    // copy assignment. Sanitized bases live in decodedBases, so the view has to be rebound to our own copy
+    numReads = other.numReads;
+    qualityString = other.qualityString;
+    decodedBases = other.decodedBases;
+    decoded = other.decoded;
+    qualities = other.qualities;
+    if (decoded) bases = boost::string_view(decodedBases).substr(0, other.bases.size());
+    else bases = other.bases;
+    return *this;
 }
 
 int SingleCellPos::refCount() {
     // Returns number of forward + backward matching reads matching reference base
-    int count = 0;
-    for (char& base: bases) {
-        if (base == '.' || base == ',') count++;
-    }   
-    return count;
+    return utility::countRefMatches(bases);
 }
 
 int SingleCellPos::countAllele(char allele) { 
     // counts the number of a specific allele
     int count = 0;
-    for (char& base: bases) {
+    for (char base: bases) {
         if (base == allele) count++;
     }
     return count;
@@ -54,119 +68,85 @@ bool SingleCellPos::hasAltAllele() {
     return numReads - refCount();
 }
 
+// Decoding of one mpileup base character: the base code (0-3) in the low bits, and flags for reference matches, reverse strand and characters that are dropped
+static const uint8_t refFlag = 4, reverseFlag = 8, skipFlag = 16;
+
+static const array<uint8_t, 256> baseTable = [] {
+    array<uint8_t, 256> table;
+    table.fill(skipFlag); // $, N, <, > and anything else unknown
+    table['.'] = refFlag;
+    table['*'] = refFlag;
+    table[','] = refFlag | reverseFlag;
+    const char* letters = "ACTG";
+    for (uint8_t code = 0; code < 4; code++) {
+        table[letters[code]] = code;
+        table[tolower(letters[code])] = code | reverseFlag;
+    }
+    return table;
+}();
+
+static inline void decodeBases(const char* text, size_t length, char refBase, char*& out, array<array<int, 2>, 4>& strandCount) {
+    // Decodes a run of plain base characters, without indels or read starts
+    for (size_t i = 0; i < length; i++) {
+        uint8_t entry = baseTable[(unsigned char) text[i]];
+        if (entry & skipFlag) continue;
+        char base = (entry & refFlag) ? refBase : (entry & 3);
+        *out++ = base;
+        strandCount[base][(entry & reverseFlag) != 0]++;
+    }
+}
+
+static inline bool isMarker(char c) {
+    // Characters that start an indel or a read, which need the scalar slow path
+    return c == '+' || c == '-' || c == '^';
+}
+
 array<array<int, 2>, 4> SingleCellPos::sanitizeBases(char refBase) { 
     // remove ins/deletions, special symbols, and cleans up all bases. Also converts to numbers. Returns the number of forward and backward strands for each base.
-    string newBases = "";
-    newBases.reserve(bases.size());
+    // Runs of plain bases are decoded through baseTable; SSE2 finds the indel and read start markers 16 characters at a time, so only those take the slow path
+    decodedBases.resize(bases.size());
+    char* out = &decodedBases[0];
     
     array<array<int, 2>, 4> strandCount;
     for (int i = 0; i < 4; i++) for (int j = 0; j < 2; j++) strandCount[i][j] = 0;
     
-    int state = 0; // 0 = normal, 1 = counting no. of ins/del, 2 = deleting ins/dels
-    int baseCount = 0; // count of the number of bases inserted/deleted
-    for (int i = 0; i < bases.size(); i++) {
-        char& c = bases[i];
-        if (state == 0) {
-            if (c == '+' || c == '-') {
-                // Insertion/deletion begins
-                state = 1;
-                baseCount = 0;
-            } else {
-                // Run other filters - start/end, and sanitize
-                if (c == '^') { // start/end
-                    i++; // skip one more character
-                } else if (c != '$') {
-                    // sanitization
-                    if (c == '.' || c == '*') {
-                        newBases += refBase;
-                        strandCount[refBase][0]++;
-                    } else if (c == ',') {
-                        newBases += refBase;
-                        strandCount[refBase][1]++;
-                    } else if (c == 'A') {
-                        newBases += char(0);
-                        strandCount[0][0]++;
-                    } else if (c == 'a') {
-                        newBases += char(0);
-                        strandCount[0][1]++;
-                    } else if (c == 'C') {
-                        newBases += char(1);
-                        strandCount[1][0]++;
-                    } else if (c == 'c') {
-                        newBases += char(1);
-                        strandCount[1][1]++;
-                    } else if (c == 'T') {
-                        newBases += char(2);
-                        strandCount[2][0]++;
-                    } else if (c == 't') {
-                        newBases += char(2);
-                        strandCount[2][1]++;
-                    } else if (c == 'G') {
-                        newBases += char(3);
-                        strandCount[3][0]++;
-                    } else if (c == 'g') {
-                        newBases += char(3);
-                        strandCount[3][1]++;
-                    }
-                }
-            }
-        } else if (state == 1) {
-            if (isdigit(c)) {
-                baseCount *= 10;
-                baseCount += (c - '0');
-            } else if (baseCount){
-                // Is base, so start removing
-                // Test for whether basecount is nonzero, so that we don't 
-                state = 2;
-                baseCount--;
-                if (baseCount == 0) state = 0;
-            } else {
-                state = 0;
-                // Run other filters - start/end, and sanitize
-                if (c == '^') { // start/end
-                    i++; // skip one more character
-                } else if (c != '$') {
-                    // sanitization
-                    if (c == '.' || c == '*') {
-                        newBases += refBase;
-                        strandCount[refBase][0]++;
-                    } else if (c == ',') {
-                        newBases += refBase;
-                        strandCount[refBase][1]++;
-                    } else if (c == 'A') {
-                        newBases += char(0);
-                        strandCount[0][0]++;
-                    } else if (c == 'a') {
-                        newBases += char(0);
-                        strandCount[0][1]++;
-                    } else if (c == 'C') {
-                        newBases += char(1);
-                        strandCount[1][0]++;
-                    } else if (c == 'c') {
-                        newBases += char(1);
-                        strandCount[1][1]++;
-                    } else if (c == 'T') {
-                        newBases += char(2);
-                        strandCount[2][0]++;
-                    } else if (c == 't') {
-                        newBases += char(2);
-                        strandCount[2][1]++;
-                    } else if (c == 'G') {
-                        newBases += char(3);
-                        strandCount[3][0]++;
-                    } else if (c == 'g') {
-                        newBases += char(3);
-                        strandCount[3][1]++;
-                    }
-                }
-            }
-        } else if (state == 2) {
-            baseCount--;
-            if (baseCount == 0) state = 0;
+    const char* text = bases.data();
+    size_t size = bases.size(), i = 0;
+    while (i < size) {
+        // Find the next marker
+        size_t marker = i;
+#ifdef __SSE2__
+        const __m128i plus = _mm_set1_epi8('+'), minus = _mm_set1_epi8('-'), caret = _mm_set1_epi8('^');
+        unsigned mask = 0;
+        for (; marker + 16 <= size; marker += 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*) (text + marker));
+            mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, plus), _mm_cmpeq_epi8(chunk, minus)), _mm_cmpeq_epi8(chunk, caret)));
+            if (mask) break;
+        }
+        if (mask) marker += __builtin_ctz(mask);
+        else
+#endif
+        while (marker < size && !isMarker(text[marker])) marker++;
+        
+        decodeBases(text + i, marker - i, refBase, out, strandCount);
+        if (marker == size) break;
+        
+        i = marker + 1;
+        if (text[marker] == '^') {
+            i++; // skip the mapping quality after a read start
+            continue;
         }
+        
+        // Indel: the length is followed by that many inserted or deleted bases, which are dropped
+        int baseCount = 0;
+        while (i < size && isdigit((unsigned char) text[i])) baseCount = baseCount*10 + (text[i++] - '0');
+        if (baseCount) i += baseCount;
+        else if (i < size && (text[i] == '+' || text[i] == '-')) i++; // a marker straight after a marker without length is dropped
     }
     
-    bases = newBases;
+    decodedBases.resize(out - &decodedBases[0]);
+    bases = decodedBases;
+    decoded = true;
     
     return strandCount;
 }
@@ -175,14 +155,14 @@ void SingleCellPos::truncateReads() {
     // truncates numReads, bases and qualities to the shortest length; a naive way of dealing with input deviations
     int minLength = min({numReads, (int)bases.size(), (int)qualityString.size()});
     numReads = minLength;
-    bases.resize(minLength);
-    qualityString.resize(minLength);
+    bases = bases.substr(0, minLength);
+    qualityString = qualityString.substr(0, minLength);
 }
 
 void SingleCellPos::computeQuality(const Phred* phred) {
     qualities.reserve(numReads);
     // Converts the quality score string into decimal scores
-    for (char& c: qualityString) {
+    for (char c: qualityString) {
         int phredVal = (int) c - 33;
         qualities.push_back(phred->qualities[phredVal]);
     }
@@ -192,7 +172,7 @@ void SingleCellPos::computeQuality(const Phred* phred) {
 array<int, 4> SingleCellPos::baseFreq() {
     // gets frequencies of each base - A, C, T, G
     array<int, 4> freq = {0};
-    for (char& c: bases) {
+    for (char c: bases) {
         freq[c]++;
     }
     return freq;
@@ -11,6 +11,8 @@
 
 #include "phred.hpp"
 
+#include <boost/utility/string_view.hpp>
+
 #include <stdio.h>
 #include <string>
 #include <vector>
@@ -21,11 +23,15 @@ using namespace std;
 
 struct SingleCellPos {
     int numReads = 0; // number of reads at position, for cell
-    string bases = ""; // bases at position, for cell
-    string qualityString = ""; // quality string for qualities at position, for cell
+    boost::string_view bases; // bases at position, for cell. Points into the pileup row until sanitized, then into decodedBases
+    boost::string_view qualityString; // quality string for qualities at position, for cell. Points into the pileup row
+    string decodedBases; // storage for sanitized bases
+    bool decoded = false; // whether bases points into decodedBases
     vector<double> qualities; // qualities for each read at position, for cell
     
-    SingleCellPos(int numReads, string& bases, string& qualityString);
+    SingleCellPos(int numReads, boost::string_view bases, boost::string_view qualityString);
+    SingleCellPos(const SingleCellPos& other); // copy constructor, keeps bases pointing at own storage
+    SingleCellPos& operator=(const SingleCellPos& other); // copy assignment, keeps bases pointing at own storage
     
     int refCount(); // gets number of forward + backward matching reads matching reference base
     bool hasReads(); // gets whether the cell has reads (nonzero read depth)
@@ -0,0 +1,251 @@
+//
+//  site_cache.cpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#include "site_cache.hpp"
+#include "utility.hpp"
+#include "ThreadPool.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <future>
+#include <stdexcept>
+
+using namespace std;
+
+static const char cacheMagic[8] = {'M', 'V', 'C', 'A', 'C', 'H', 'E', '1'};
+static const size_t fileHeaderSize = 16; // magic, numCells, reserved
+static const size_t siteHeaderSize = 4 + 8 + 4*3 + 4*8 + 1 + 1 + 2; // fixed part of a site record
+
+template<class T>
+static void put(string& out, T value) {
+    // appends value to out in native byte order
+    out.append((const char*) &value, sizeof(T));
+}
+
+template<class T>
+static T get(const char*& in) {
+    // reads a value from in and advances it; in may be unaligned
+    T value;
+    memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+    return value;
+}
+
+bool siteCache::isSiteCache(string filename) {
+    // Checks whether filename starts with the site cache magic
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) return false;
+    char magic[8];
+    bool matches = fread(magic, 1, 8, file) == 8 && !memcmp(magic, cacheMagic, 8);
+    fclose(file);
+    return matches;
+}
+
+SiteCacheWriter::SiteCacheWriter(string filename, int numCells): filename(filename), numCells(numCells), numSites(0) {
+    file = fopen(filename.c_str(), "wb");
+    if (!file) throw runtime_error("Could not create site cache " + filename);
+    string header(cacheMagic, 8);
+    put<uint32_t>(header, numCells);
+    put<uint32_t>(header, 0);
+    if (fwrite(header.data(), 1, header.size(), file) != header.size()) {
+        fclose(file); // the destructor does not run when the constructor throws
+        throw runtime_error("Could not write to site cache " + filename);
+    }
+}
+
+SiteCacheWriter::~SiteCacheWriter() {
+    // Best effort, as a destructor can not throw: errors are only thrown from an explicit close
+    try {
+        close();
+    } catch (exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+void SiteCacheWriter::close() {
+    // Buffered records only reach the disk here, so a full disk shows up as a failed flush or close
+    if (!file) return;
+    bool failed = fflush(file) != 0;
+    failed |= fclose(file) != 0;
+    file = nullptr;
+    if (failed) throw runtime_error("Could not write to site cache " + filename);
+}
+
+string SiteCacheWriter::serializeSite(long rowIndex, const Pileup& site) {
+    // Encodes a prepared site in the record layout
+    string record;
+    put<uint32_t>(record, 0); // record size, filled in below
+    put<int64_t>(record, rowIndex);
+    put<int32_t>(record, site.seqPos);
+    put<int32_t>(record, site.rawTotalDepth);
+    put<int32_t>(record, site.rawRefDepth);
+    for (int i = 0; i < 4; i++) for (int j = 0; j < 2; j++) put<int32_t>(record, site.strandCount[i][j]);
+    put<uint8_t>(record, site.refBase);
+    put<uint8_t>(record, site.altBase);
+    put<uint16_t>(record, site.seqID.size());
+    record += site.seqID;
+    
+    // Columns
+    for (auto& cell: site.allCells) put<uint32_t>(record, cell.numReads);
+    for (auto& cell: site.allCells) record.append(cell.bases.data(), cell.numReads);
+    for (auto& cell: site.allCells) record.append(cell.qualityString.data(), cell.numReads);
+    
+    uint32_t recordSize = record.size();
+    memcpy(&record[0], &recordSize, 4);
+    return record;
+}
+
+void SiteCacheWriter::convertRows(RowSource& rows) {
+    // Worker loop: the same prefilter and preparation as App::processPileup, without anything that depends on -t/-p/-a
+    try {
+        Row row;
+        while (rows.next(row)) {
+            string record; // stays empty if the site is dropped
+            if (row.site || (row.text.size() && !utility::prefilterRow(numCells, row.text))) {
+                Pileup parsed;
+                if (!row.site) parsed = utility::getPileup(numCells, row.text);
+                Pileup& site = row.site ? *row.site : parsed;
+                
+                site.countDepths();
+                if (!utility::prefilterSite(site.rawTotalDepth, site.rawRefDepth, site.refBase) && site.prepare()) record = serializeSite(row.index, site);
+            }
+            if (!records->submit(row.order, move(record))) return; // another thread failed
+        }
+    } catch (...) {
+        records->abort();
+        throw;
+    }
+}
+
+void SiteCacheWriter::writeRecords() {
+    // Writer loop, appends records in input order
+    try {
+        string record;
+        while (records->pop(record)) {
+            if (!record.size()) continue;
+            if (fwrite(record.data(), 1, record.size(), file) != record.size()) throw runtime_error("Could not write to site cache");
+            numSites++;
+        }
+    } catch (...) {
+        records->abort();
+        throw;
+    }
+}
+
+void SiteCacheWriter::convert(RowSource& rows, int numThreads, int reorderSize) {
+    // Prefilters and prepares all rows of rows on numThreads threads, while one writer appends the records in input order
+    records.reset(new ReorderBuffer<string>(reorderSize + numThreads * rows.orderSpan()));
+    future<void> writer = async(launch::async, &SiteCacheWriter::writeRecords, this);
+    try {
+        if (numThreads > 1) {
+            ThreadPool pool(numThreads);
+            vector<future<void>> workers;
+            for (int i = 0; i < numThreads; i++) workers.push_back(pool.enqueue(&SiteCacheWriter::convertRows, this, ref(rows)));
+            for (auto& worker: workers) worker.get(); // rethrows errors from workers
+        } else convertRows(rows);
+    } catch (...) {
+        records->abort();
+        writer.wait();
+        throw;
+    }
+    records->close();
+    writer.get(); // rethrows errors from writing
+}
+
+long SiteCacheWriter::sitesWritten() {
+    return numSites;
+}
+
+SiteCacheReader::SiteCacheReader(string filename, int numCells): cursor(fileHeaderSize), numCells(numCells) {
+    fprintf(stderr, "Mapping site cache %s\n", filename.c_str());
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Could not open site cache " + filename);
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size < fileHeaderSize) {
+        close(fd);
+        throw runtime_error("Could not read site cache " + filename);
+    }
+    size = info.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (mapped == MAP_FAILED) throw runtime_error("Could not map site cache " + filename);
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    data = (const char*) mapped;
+    
+    const char* header = data + 8;
+    int cacheCells = get<uint32_t>(header);
+    if (memcmp(data, cacheMagic, 8) || cacheCells != numCells) {
+        munmap(mapped, size);
+        data = nullptr;
+        throw runtime_error("Site cache " + filename + " was written for " + to_string(cacheCells) + " cells, but " + to_string(numCells) + " bam files are given");
+    }
+}
+
+SiteCacheReader::~SiteCacheReader() {
+    if (data) munmap((void*) data, size);
+}
+
+bool SiteCacheReader::next(Row& row) {
+    // Claims the next record under the lock, then builds the site from it without copying bases or qualities
+    const char* record;
+    {
+        lock_guard<mutex> lock(cursorMutex);
+        if (cursor + siteHeaderSize > size) return false;
+        record = data + cursor;
+        uint32_t recordSize;
+        memcpy(&recordSize, record, 4);
+        if (recordSize < siteHeaderSize || cursor + recordSize > size) throw runtime_error("Site cache is truncated");
+        cursor += recordSize;
+        row.order = numSites++;
+    }
+    
+    const char* in = record + 4;
+    unique_ptr<Pileup> site(new Pileup());
+    row.index = get<int64_t>(in);
+    site->seqPos = get<int32_t>(in);
+    site->rawTotalDepth = get<int32_t>(in);
+    site->rawRefDepth = get<int32_t>(in);
+    for (int i = 0; i < 4; i++) for (int j = 0; j < 2; j++) site->strandCount[i][j] = get<int32_t>(in);
+    site->refBase = get<uint8_t>(in);
+    site->altBase = get<uint8_t>(in);
+    int nameLength = get<uint16_t>(in);
+    site->seqID.assign(in, nameLength);
+    in += nameLength;
+    
+    const char* counts = in;
+    const char* bases = counts + 4*numCells;
+    size_t totalReads = 0;
+    for (int i = 0; i < numCells; i++) totalReads += get<uint32_t>(in);
+    const char* qualities = bases + totalReads;
+    
+    // All cells go to allCells, and those with reads to cells, as filterCellsWithRead leaves them
+    site->allCells.reserve(numCells);
+    for (int i = 0; i < numCells; i++) {
+        int numReads = get<uint32_t>(counts);
+        site->allCells.push_back(SingleCellPos(numReads, boost::string_view(bases, numReads), boost::string_view(qualities, numReads)));
+        if (numReads) site->cells.push_back(site->allCells.back());
+        bases += numReads;
+        qualities += numReads;
+    }
+    site->numCells = site->cells.size();
+    site->prepared = true;
+    
+    row.site = move(site);
+    return true;
+}
+
+long SiteCacheReader::rowsRead() {
+    lock_guard<mutex> lock(cursorMutex);
+    return numSites;
+}
@@ -0,0 +1,69 @@
+//
+//  site_cache.hpp
+//  MonovarNG
+//
+//  Copyright © 2026 Warren W. Kretzschmar. All rights reserved.
+//
+
+#ifndef site_cache_hpp
+#define site_cache_hpp
+
+#include "row_source.hpp"
+#include "pileup.hpp"
+#include "reorder_buffer.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+using namespace std;
+
+// A site cache holds the sites of a pileup that pass the prefilter, already sanitized, so that calling again with other -t/-p/-a values skips all text processing.
+// Layout, in native byte order: the magic "MVCACHE1", uint32 numCells, uint32 reserved, then one record per site:
+//   uint32 record size in bytes, int64 row index in the original pileup, int32 position, int32 raw depth, int32 raw reference depth,
+//   int32 strand counts [4][2], uint8 reference base, uint8 alt base, uint16 sequence name length, sequence name,
+//   followed by the columns uint32 reads [numCells], uint8 bases [total reads] (0-3), uint8 qualities [total reads] (phred+33)
+
+namespace siteCache {
+    bool isSiteCache(string filename); // checks whether filename starts with the site cache magic
+}
+
+class SiteCacheWriter {
+    // Converts pileup rows into a site cache, keeping only the sites that survive the prefilter
+    string filename;
+    FILE* file;
+    int numCells; // number of cells in each site
+    atomic<long> numSites; // sites written so far
+    unique_ptr<ReorderBuffer<string>> records; // record of each row, empty where the site is dropped, put back in input order for the writer thread
+    
+    static string serializeSite(long rowIndex, const Pileup& site); // encodes a prepared site as a record
+    void convertRows(RowSource& rows); // worker loop, converts rows until the source is exhausted
+    void writeRecords(); // writer loop, appends records in input order
+public:
+    SiteCacheWriter(string filename, int numCells); // creates filename and writes the header
+    ~SiteCacheWriter();
+    
+    void convert(RowSource& rows, int numThreads, int reorderSize); // prefilters and prepares all rows of rows, writing those that survive in input order
+    void close(); // flushes and closes the file, throwing if any of it could not be written
+    long sitesWritten();
+};
+
+class SiteCacheReader: public RowSource {
+    // Serves prepared sites from a memory-mapped site cache; cells point straight into the mapping
+    const char* data = nullptr; // start of mapped file
+    size_t size = 0; // length of mapped file
+    size_t cursor; // offset of the first record not yet handed out
+    int numCells; // number of cells in each site
+    long numSites = 0; // sites handed out so far
+    mutex cursorMutex; // guards cursor and numSites
+public:
+    SiteCacheReader(string filename, int numCells); // maps filename, checking it was written for numCells cells
+    ~SiteCacheReader();
+    
+    bool next(Row& row);
+    long rowsRead();
+};
+
+#endif /* site_cache_hpp */
@@ -10,15 +10,102 @@
 #include "single_cell_pos.hpp"
 #include "utility.hpp"
 #include "wrdouble.hpp"
+#include "pileup.hpp"
+#include "combination.hpp"
+#include "phred.hpp"
 
 #include <iostream>
 #include <array>
 #include <chrono>
 #include <vector>
+#include <string>
+#include <cmath>
 
 using namespace std;
 using namespace utility;
 
+static vector<wrdouble> recurrenceDP(const vector<array<wrdouble, 3>>& likelihoods, int skip) {
+    // The dp for h_j,l over all cells but skip, with an exponent for every entry, as it was first written
+    vector<wrdouble> previous(1, wrdouble(1.0)), row;
+    wrdouble wr2 = 2.0;
+    for (int j = 0; j < likelihoods.size(); j++) {
+        if (j == skip) continue;
+        row.assign(previous.size()+2, wrdouble(0.0));
+        for (int l = 0; l < row.size(); l++) {
+            if (l < previous.size()) row[l] += previous[l]*likelihoods[j][0];
+            if (l >= 1 && l-1 < previous.size()) row[l] += previous[l-1]*likelihoods[j][1]*wr2;
+            if (l >= 2) row[l] += previous[l-2]*likelihoods[j][2];
+        }
+        swap(previous, row);
+    }
+    return previous;
+}
+
+static wrdouble weightedSum(const vector<wrdouble>& dp, const Combination& combi) {
+    // sum of the alt count likelihoods times their priors, the base of the probability of zero mutations
+    int numCells = dp.size()/2;
+    vector<double> altCountPriors = genAltCountPriors(numCells);
+    vector<wrdouble> combis;
+    combi.getRow(2*numCells, combis);
+    wrdouble sum = 0.0;
+    for (int l = 0; l <= 2*numCells; l++) sum += dp[l] / combis[l] * altCountPriors[l];
+    return sum;
+}
+
+static bool agree(wrdouble a, wrdouble b) {
+    // whether a and b agree to 1e-9 relative, or are both 0
+    if (b.value == 0) return a.value == 0;
+    return fabs(double(a/b) - 1) < 1e-9;
+}
+
+bool testCombinations(FILE* out) {
+    // Rows built on demand beyond Combination::maxTableWidth must match the stored table bit for bit, and the closed forms its first entries
+    Combination table(Combination::maxTableWidth), built(Combination::maxTableWidth+1);
+    vector<wrdouble> stored, rebuilt;
+    bool passed = true;
+    for (int n: {0, 1, 2, 57, 120, 511, Combination::maxTableWidth}) {
+        table.getRow(n, stored);
+        built.getRow(n, rebuilt);
+        bool same = stored.size() == rebuilt.size();
+        for (int r = 0; same && r < stored.size(); r++) same = stored[r].value == rebuilt[r].value && stored[r].exponent == rebuilt[r].exponent;
+        for (int r = 0; same && r <= min(n, 2); r++) same = double(stored[r]) == double(table.getValue(n, r)); // the closed forms of computeC
+        if (!same) fprintf(out, "Row %d of combinations differs between the table and Pascal's rule\n", n);
+        passed = passed && same;
+    }
+    fprintf(out, "combinations: %s\n", passed ? "table and built rows agree" : "differ");
+    return passed;
+}
+
+bool testLargeCohortDP(FILE* out) {
+    // Two cells with three alt reads and numCells-2 with one ref read each. h_j,l then falls by about 2^-1000 per l,
+    // while dividing by 2*numCells C l lifts it back, so a dp that flushes small entries loses the variant
+    Phred phred;
+    array<array<array<double, 4>, 4>, 4> genotypePriors = genGenotypePriors(0.002);
+    bool passed = true;
+    for (int numCells: {300, 1200, 2000}) {
+        string row = "1\t100\tA";
+        for (int i = 0; i < numCells; i++) row += i < 2 ? "\t3\tCCC\tIII" : "\t1\t.\tI";
+        Combination combi(2*numCells);
+        Pileup site(numCells, row);
+        site.setObjs(&combi, &phred);
+        site.prepare();
+        site.computeQualities();
+        wrdouble zeroVarProb = site.computeZeroVarProb(genotypePriors, 0.02);
+        
+        // The probability of zero mutations, and the base of a genotype, against the recurrence
+        vector<wrdouble> dp, expected = recurrenceDP(site.likelihoodsGlob, -1);
+        wrdouble expectedZeroVarProb = expected[0] * genAltCountPriors(numCells)[0] / weightedSum(expected, combi);
+        bool siteAgrees = agree(zeroVarProb, expectedZeroVarProb);
+        site.computeDP(site.likelihoodsGlob, 0, dp);
+        expected = recurrenceDP(site.likelihoodsGlob, 0);
+        bool genotypeAgrees = dp.size() == expected.size() && agree(weightedSum(dp, combi), weightedSum(expected, combi));
+        
+        fprintf(out, "%d cells: zeroVarProb %s, expected %s; genotype dp %s\n", numCells, string(zeroVarProb).c_str(), string(expectedZeroVarProb).c_str(), genotypeAgrees ? "agrees" : "differs");
+        passed = passed && siteAgrees && genotypeAgrees;
+    }
+    return passed;
+}
+
 void test() {
     // Universal testing function
     
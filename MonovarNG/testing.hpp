@@ -12,5 +12,7 @@
 #include <stdio.h>
 
 void test(); // Universal test function
+bool testCombinations(FILE* out); // checks the rows Combination builds on demand against its table, writing the result to out. Returns true if they agree
+bool testLargeCohortDP(FILE* out); // checks computeDP against the wrdouble recurrence with an exponent per entry on large cohorts, writing each comparison to out. Returns true if all agree
 
 #endif /* testing_hpp */
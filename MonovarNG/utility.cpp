@@ -10,15 +10,32 @@
 #include "utility.hpp"
 #include "pileup.hpp"
 #include "wrdouble.hpp"
+#include "pileup_reader.hpp"
+#include "bam_pileup.hpp"
+#include "site_cache.hpp"
+#include "bcf.hpp"
+#include "ThreadPool.h"
 
 #include <boost/algorithm/string.hpp>
 #include <htslib/sam.h>
+#include <htslib/kstring.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <array>
+#include <cctype>
+#include <stdexcept>
+#include <unordered_map>
+#include <atomic>
+#include <future>
+#include <algorithm>
 
 using namespace std;
 using namespace utility;
@@ -28,7 +45,7 @@ Config utility::setupConfig(int argc, const char *argv[]) {
     Config config;
     
     if (argc < 5) {
-        throw invalid_argument("Incorrect arguments.\nUsage: monovar referenceFile bamFilenames pileupFile outputFile [-patm]\nOptions:\n-t: Threshold to be used for variant calling (Recommended value: 0.05)\n-p: Offset for prior probability for false-positive error (Recommended value: 0.002)\n-a: Offset for prior probability for allelic drop out (Default value: 0.2)\n-m: Number of threads to use in multiprocessing (Default value: 4)");
+        throw invalid_argument("Incorrect arguments.\nUsage: monovar referenceFile bamFilenames pileupFile outputFile [-patmiqQ@rjsgxn]\n       monovar cache referenceFile bamFilenames pileupFile cacheFile [-miqQ@rj]\n       monovar index pileupFile [rowsPerChunk]\n       monovar accuracy referenceFile bamFilenames pileupFile reportFile [-patmn]\n       monovar bench [operations]\nOptions:\n-t: Threshold to be used for variant calling (Recommended value: 0.05)\n-p: Offset for prior probability for false-positive error (Recommended value: 0.002)\n-a: Offset for prior probability for allelic drop out (Default value: 0.2)\n-m: Number of threads to use in multiprocessing (Default value: 4)\n-n: Numeric engine for likelihoods, wrdouble, log or auto (Default value: wrdouble)\n-i: Input mode, stream, mmap or bam (Default value: stream). With bam, the bam or cram files are piled up directly and pileupFile is ignored\n-q: Minimum mapping quality, for input mode bam (Default value: 0)\n-Q: Minimum base quality, for input mode bam (Default value: 13)\n-@: Number of threads for decompressing a bgzipped pileup, and for compressing a .gz output (Default value: 2)\n-r: Regions to call, as chr:start-end separated by commas. Needs a bgzipped pileup indexed with tabix -s 1 -b 2 -e 2 (Default: whole pileup). Plain-text pileups indexed with monovar index are also supported\n-j: Shard to call, as i/n for the i-th of n equal parts of a pileup indexed with monovar index (Default: whole pileup)\n-s: Sparse output: cells without reads are written as ., reference calls with at least the given GQ as a bare 0/0, and the INFO field IC lists the cells written in full (Default: every cell in full)\n-g: File to write gVCF-style blocks of the sites that are not called to, as a sites-only vcf (Default: none)\n-x: Prefix of files to also write the genotypes of the called sites to, as a 2-bit packed sites x cells matrix (prefix.gt) with the site (prefix.sites) and cell (prefix.cells) names (Default: none)\nmonovar cache writes the sites of pileupFile that pass the prefilter to cacheFile, which can then be given as pileupFile to call again quickly\nmonovar index writes pileupFile.mvi, recording where every rowsPerChunk rows (Default value: 10000) start, so a plain-text pileup is parsed in parallel and can be split with -r and -j\nmonovar accuracy calls pileupFile with wrdouble and with the -n engine (Default: log), and writes how much their QUAL, PL, GQ and GT differ to reportFile");
     }
     
     config.referenceFilename = argv[1];
@@ -54,6 +71,44 @@ Config utility::setupConfig(int argc, const char *argv[]) {
                 case 'm':
                     config.numThreads = atoi(argv[i+1]);
                     break;
+                case 'n':
+                    config.numericEngine = argv[i+1];
+                    break;
+                case 'i':
+                    config.inputMode = argv[i+1];
+                    break;
+                case 'q':
+                    config.minMapQ = atoi(argv[i+1]);
+                    break;
+                case 'Q':
+                    config.minBaseQ = atoi(argv[i+1]);
+                    break;
+                case '@':
+                    config.ioThreads = atoi(argv[i+1]);
+                    break;
+                case 's':
+                    config.sparseGQ = atoi(argv[i+1]);
+                    if (config.sparseGQ < 0) throw invalid_argument("-s needs a GQ of at least 0");
+                    break;
+                case 'x':
+                    config.matrixPrefix = argv[i+1];
+                    break;
+                case 'g':
+                    config.blockFilename = argv[i+1];
+                    break;
+                case 'j':
+                    if (sscanf(argv[i+1], "%d/%d", &config.shard, &config.numShards) != 2 || config.shard < 1 || config.shard > config.numShards) throw invalid_argument("-j needs a shard as i/n, with 1 <= i <= n");
+                    config.shard--; // 0-based from here on
+                    break;
+                case 'r': {
+                    vector<string> regions;
+                    boost::split(regions, argv[i+1], boost::is_any_of(","));
+                    for (string& region: regions) {
+                        boost::trim(region);
+                        if (region.size()) config.regions.push_back(region);
+                    }
+                    break;
+                }
             }
         }
     }
@@ -79,83 +134,282 @@ vector<string> utility::getBamFilenames(string filename) {
     return bamNames;
 }
 
-vector<string> utility::getBamIDs(string filename) {
-    // Gets bam IDs for all bam files named in file (at filename)
-    vector<string> ids;
+struct BamIDEntry {
+    // Read group ID of a bam file, as of a size and modification time
+    long long size = -1, mtime = -1;
+    string id;
+};
+
+static bool bamStats(const string& filename, long long& size, long long& mtime) {
+    // gets size and modification time of filename
+    struct stat info;
+    if (stat(filename.c_str(), &info) < 0) return false;
+    size = info.st_size;
+    mtime = info.st_mtime;
+    return true;
+}
+
+static string readBamID(const string& filename) {
+    // Reads the ID of the first @RG line through the header API, or returns filename if the file has none or cannot be read
+    string id = filename;
+    samFile* samfile = sam_open(filename.c_str(), "r");
+    if (!samfile) return id;
+    sam_hdr_t* header = sam_hdr_read(samfile);
+    if (header) {
+        kstring_t value = KS_INITIALIZE;
+        if (sam_hdr_find_tag_pos(header, "RG", 0, "ID", &value) == 0) {
+            id = value.s;
+            boost::trim(id);
+        }
+        ks_free(&value);
+        sam_hdr_destroy(header);
+    }
+    sam_close(samfile);
+    return id;
+}
+
+vector<string> utility::getBamIDs(string filename, int numThreads) {
+    // Gets bam IDs for all bam files named in file (at filename). Headers are read on numThreads threads, and IDs are cached in filename.ids, keyed by path, size and modification time
+    vector<string> bamNames = getBamFilenames(filename);
     
-    ifstream bamNameFile;
-    bamNameFile.open(filename);
+    // Load cached IDs
+    string cacheFilename = filename + ".ids";
+    unordered_map<string, BamIDEntry> cache;
+    ifstream cacheFile(cacheFilename);
+    string line;
+    vector<string> tokens;
+    while (getline(cacheFile, line)) {
+        boost::split(tokens, line, boost::is_any_of("\t"));
+        if (tokens.size() != 4) continue;
+        BamIDEntry entry;
+        try {
+            entry.size = stoll(tokens[1]);
+            entry.mtime = stoll(tokens[2]);
+        } catch (logic_error&) {
+            continue; // damaged line, so that bam is read again
+        }
+        entry.id = tokens[3];
+        cache[tokens[0]] = entry;
+    }
+    cacheFile.close();
     
-    // Get bam names
-    vector<string> bamNames;
-    string tmp;
-    while (getline(bamNameFile, tmp)) {
-        boost::trim(tmp);
-        if (tmp.size()) { // check if tmp is whitespace only 
-            bamNames.push_back(tmp);
+    // Read the headers of bam files that are new or changed since they were cached
+    vector<BamIDEntry> entries(bamNames.size());
+    atomic<int> headersRead(0);
+    auto lookup = [&](size_t i) {
+        BamIDEntry& entry = entries[i];
+        if (!bamStats(bamNames[i], entry.size, entry.mtime)) {
+            entry.id = bamNames[i]; // unreadable, so named by filename and not cached
+            return;
+        }
+        auto cached = cache.find(bamNames[i]);
+        if (cached != cache.end() && cached->second.size == entry.size && cached->second.mtime == entry.mtime) {
+            entry.id = cached->second.id;
+            return;
         }
+        entry.id = readBamID(bamNames[i]);
+        headersRead++;
+    };
+    {
+        ThreadPool pool(max(1, min(numThreads, (int) bamNames.size())));
+        vector<future<void>> lookups;
+        for (size_t i = 0; i < bamNames.size(); i++) lookups.push_back(pool.enqueue(lookup, i));
+        for (auto& done: lookups) done.get();
     }
-    bamNameFile.close();
-
-    // Open each bam file and get its readgroup ID
-    for (string file: bamNames) {
-        ifstream f(file.c_str());
-        if (!f.good()); {
-            ids.push_back(file);
-	    f.close();
-	    continue;
-	}
-	f.close();
-        samFile * samfile = sam_open(file.c_str(), "r");
-        bam_hdr_t * header = sam_hdr_read(samfile);
-        string headerText = (*header).text;
-        
-        vector<string> lines;
-        boost::split(lines, headerText, boost::is_any_of("\n"));
-        for (string line: lines) {
-            if (boost::starts_with(line, "@RG")) {
-                vector<string> tokens;
-                boost::split(tokens, line, boost::is_any_of("\t"));
-                for (string token: tokens) {
-                    if (boost::starts_with(token, "ID")) {
-                        vector<string> items;
-                        boost::split(items, token, boost::is_any_of(":"));
-                        string id = items[1];
-                        boost::trim(id);
-                        ids.push_back(id);
-                    }
-                }
-            }
+    
+    // Rewrite the cache if any header was read; failing to write it only costs the next run time.
+    // Shard jobs may read it at the same time, so it is written to a file of this host and process next to it, and renamed into place once complete
+    if (headersRead) {
+        char host[256] = "";
+        gethostname(host, sizeof(host)-1);
+        string tempFilename = cacheFilename + ".tmp." + host + "." + to_string(getpid());
+        ofstream newCache(tempFilename);
+        for (size_t i = 0; i < bamNames.size(); i++) {
+            if (entries[i].size >= 0) newCache << bamNames[i] << "\t" << entries[i].size << "\t" << entries[i].mtime << "\t" << entries[i].id << "\n";
+        }
+        newCache.close();
+        if (!newCache.good() || rename(tempFilename.c_str(), cacheFilename.c_str())) {
+            fprintf(stderr, "Could not write read group cache %s\n", cacheFilename.c_str());
+            remove(tempFilename.c_str());
         }
     }
     
+    vector<string> ids;
+    for (BamIDEntry& entry: entries) ids.push_back(entry.id);
     return ids;
 }
 
-vector<string> utility::readPileup(int numCells, string filename) {
-    // Reads from pileup file, saving it as a vector of strings
-    printf("Reading from %s\n", filename.c_str());
-    ifstream pileupFile;
-    pileupFile.open(filename);
-    
-    vector<string> rows;
+unique_ptr<RowSource> utility::openPileup(Config& config, int numCells) {
+    // Opens the pileup file with the reader for config.inputMode, or as a site cache if it is one
+    if (config.inputMode != "bam" && config.pileupFilename != "-" && siteCache::isSiteCache(config.pileupFilename)) {
+        if (config.regions.size()) throw invalid_argument("Regions can not be used with a site cache");
+        return unique_ptr<RowSource>(new SiteCacheReader(config.pileupFilename, numCells));
+    }
     
-    string row;
-    while (getline(pileupFile, row)) {
-        boost::trim(row);
-        if (row.size()) {
-            rows.push_back(row);
-        }
+    // Plain-text pileups with an up to date index are read in chunks, in parallel
+    vector<pileupIndex::Entry> entries;
+    if ((config.inputMode == "stream" || config.inputMode == "mmap") && config.pileupFilename != "-" && pileupIndex::load(config.pileupFilename, entries)) {
+        return unique_ptr<RowSource>(new IndexedPileupReader(config.pileupFilename, entries, config.regions, config.shard, config.numShards));
     }
-    printf("%d positions read.\n", rows.size());
-    return rows;
+    if (config.numShards > 1) throw invalid_argument("Shards need a plain-text pileup indexed with monovar index");
+    if (config.regions.size() && config.inputMode != "stream") throw invalid_argument("Regions can only be used with input mode stream, or an indexed pileup");
+    if (config.inputMode == "stream") return unique_ptr<RowSource>(new PileupReader(config.pileupFilename, config.queueSize, config.ioThreads, config.regions));
+    if (config.inputMode == "mmap" && config.pileupFilename == "-") throw invalid_argument("Input mode mmap can not read from stdin");
+    if (config.inputMode == "mmap") return unique_ptr<RowSource>(new MappedPileupReader(config.pileupFilename));
+    if (config.inputMode == "bam") return unique_ptr<RowSource>(new BamPileupReader(getBamFilenames(config.bamfileNames), config.referenceFilename, config.minMapQ, config.minBaseQ, config.queueSize));
+    throw invalid_argument("Unknown input mode " + config.inputMode + ", expected stream, mmap or bam");
 }
 
-Pileup utility::getPileup(int numCells, string& row) {
+unique_ptr<VariantDocument> utility::openOutput(Config& config) {
+    // Creates the output file in the format its name asks for
+    if (boost::ends_with(config.outputFilename, ".bcf")) return unique_ptr<VariantDocument>(new BCFDocument(config.outputFilename, config.ioThreads, config.sparseGQ));
+    return unique_ptr<VariantDocument>(new VCFDocument(config.outputFilename, config.ioThreads, config.sparseGQ));
+}
+
+Pileup utility::getPileup(int numCells, boost::string_view row) {
     // Parses a row of pileup and return a pileup object
     return Pileup(numCells, row);
 }
 
+int utility::prefilterSite(int totalDepth, int refDepth, char refBase) {
+    // Cheap filter on read counts and reference base, before bases are parsed. Returns the reason a site is filtered, or 0 if it is kept
+    int altCount = totalDepth - refDepth; // no. of alternate reads
+    double altFreq;
+    if (totalDepth == 0) altFreq = 0;
+    else altFreq = (double) altCount / totalDepth;
+    
+    if (totalDepth == refDepth) return 1; // no reads supporting alternate allele, so no operations needed
+    else if (totalDepth > 30 && (altCount <= 2 || altFreq <= 0.001)) return 2; // prefiltered due to unlikely mutation
+    else if (string("ATGC").find(refBase) == string::npos) return 3; // bad reference
+    else if (totalDepth <= 10) return 4; // insufficient data
+    return 0;
+}
+
+int utility::prefilterRow(int numCells, boost::string_view row, ReferenceSite* reference) {
+    // Gets the depths and reference base prefilterSite needs from the columns of row. Malformed rows are kept, so that parsing them reports the error
+    static thread_local vector<boost::string_view> tokens;
+    splitFields(row, '\t', tokens);
+    if (tokens.size() < 3*numCells+3) return 0;
+    
+    boost::string_view ref = trimView(tokens[2]);
+    char refBase = ref.size() ? toupper(ref[0]) : 0;
+    
+    int totalDepth = 0, refDepth = 0, pos = 0;
+    try {
+        for (int i = 0; i < numCells; i++) {
+            totalDepth += parseInt(tokens[3*i+3]);
+            refDepth += countRefMatches(tokens[3*i+4]);
+        }
+        if (reference) pos = parseInt(tokens[1]);
+    } catch (logic_error&) {
+        return 0; // malformed depth or position
+    }
+    int filter = prefilterSite(totalDepth, refDepth, refBase);
+    if (filter && reference) {
+        reference->seqID.assign(tokens[0].data(), tokens[0].size());
+        reference->pos = pos;
+        reference->ref = refBase;
+        reference->depth = totalDepth;
+        reference->filter = filter;
+    }
+    return filter;
+}
+
+int utility::countRefMatches(boost::string_view bases) {
+    // Counts the '.' and ',' in bases, 16 bytes at a time where SSE2 is available
+    const char* data = bases.data();
+    size_t size = bases.size(), i = 0;
+    int count = 0;
+#ifdef __SSE2__
+    const __m128i dots = _mm_set1_epi8('.');
+    const __m128i commas = _mm_set1_epi8(',');
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i matches = _mm_or_si128(_mm_cmpeq_epi8(chunk, dots), _mm_cmpeq_epi8(chunk, commas));
+        count += __builtin_popcount(_mm_movemask_epi8(matches));
+    }
+#endif
+    for (; i < size; i++) {
+        if (data[i] == '.' || data[i] == ',') count++;
+    }
+    return count;
+}
+
+static inline void addDelimiters(const char* data, size_t offset, unsigned mask, size_t& start, vector<boost::string_view>& fields) {
+    // Ends a field at each set bit of mask, where bit i stands for the byte at offset+i
+    while (mask) {
+        size_t end = offset + __builtin_ctz(mask);
+        fields.emplace_back(data + start, end - start);
+        start = end + 1;
+        mask &= mask - 1;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static size_t splitFieldsAVX2(const char* data, size_t size, char delimiter, size_t& start, vector<boost::string_view>& fields) {
+    // Finds delimiters 32 bytes at a time. Returns the offset up to which data was scanned
+    const __m256i delimiters = _mm256_set1_epi8(delimiter);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (data + i));
+        addDelimiters(data, i, _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, delimiters)), start, fields);
+    }
+    return i;
+}
+
+static const bool hasAVX2 = __builtin_cpu_supports("avx2"); // checked once, so binaries built without -mavx2 still use it
+#endif
+
+void utility::splitFields(boost::string_view row, char delimiter, vector<boost::string_view>& fields) {
+    // Splits row at each delimiter into fields, which point into row, in one pass over row. Reuses the storage of fields
+    fields.clear();
+    const char* data = row.data();
+    size_t size = row.size(), i = 0, start = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (hasAVX2) i = splitFieldsAVX2(data, size, delimiter, start, fields);
+#endif
+#ifdef __SSE2__
+    const __m128i delimiters = _mm_set1_epi8(delimiter);
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (data + i));
+        addDelimiters(data, i, _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, delimiters)), start, fields);
+    }
+#endif
+    for (; i < size; i++) {
+        if (data[i] == delimiter) {
+            fields.emplace_back(data + start, i - start);
+            start = i + 1;
+        }
+    }
+    fields.emplace_back(data + start, size - start);
+}
+
+boost::string_view utility::trimView(boost::string_view text) {
+    // Removes leading and trailing whitespace from text
+    size_t start = 0, end = text.size();
+    while (start < end && isspace((unsigned char) text[start])) start++;
+    while (end > start && isspace((unsigned char) text[end-1])) end--;
+    return text.substr(start, end-start);
+}
+
+int utility::parseInt(boost::string_view text) {
+    // Parses a decimal integer, like stoi: leading whitespace and a sign are allowed, trailing characters are ignored
+    size_t i = 0;
+    while (i < text.size() && isspace((unsigned char) text[i])) i++;
+    bool negative = false;
+    if (i < text.size() && (text[i] == '-' || text[i] == '+')) negative = text[i++] == '-';
+    if (i == text.size() || !isdigit((unsigned char) text[i])) throw invalid_argument("parseInt: no digits in \"" + text.to_string() + "\"");
+    long value = 0;
+    for (; i < text.size() && isdigit((unsigned char) text[i]); i++) {
+        value = value*10 + (text[i] - '0');
+        if (value > 2147483648L) throw out_of_range("parseInt: \"" + text.to_string() + "\" out of range");
+    }
+    if (negative) value = -value;
+    if (value > 2147483647L) throw out_of_range("parseInt: \"" + text.to_string() + "\" out of range");
+    return (int) value;
+}
+
 array<array<array<double, 4>, 4>, 4> utility::genGenotypePriors(double p) {
     // Generates genotype priors matrix given probability p. priors[a][b][c] = p(^ab)(_c)
     array<array<array<double, 4>, 4>, 4> priors;
@@ -12,9 +12,15 @@
 #include "config.hpp"
 #include "pileup.hpp"
 #include "wrdouble.hpp"
+#include "row_source.hpp"
+#include "vcf.hpp"
+#include "reference_blocks.hpp"
+
+#include <boost/utility/string_view.hpp>
 
 #include <stdio.h>
 #include <array>
+#include <memory>
 
 using namespace std;
 
@@ -24,11 +30,25 @@ namespace utility {
     
     vector<string> getBamFilenames(string filename); // Gets bam filenames for all bam files named in file (at filename)
     
-    vector<string> getBamIDs(string filename); // Gets bam IDs for all bam files named in file (at filename). RG IDs, not filename
+    vector<string> getBamIDs(string filename, int numThreads = 4); // Gets bam IDs for all bam files named in file (at filename). RG IDs, not filename. Headers are read in parallel and cached in filename.ids
+    
+    unique_ptr<RowSource> openPileup(Config& config, int numCells); // Opens the pileup file with the reader for config.inputMode, or as a site cache if it is one
+    
+    unique_ptr<VariantDocument> openOutput(Config& config); // Creates the output file, as bcf for filenames ending in .bcf and as vcf otherwise
+    
+    Pileup getPileup(int numCells, boost::string_view row); // Parses a row of pileup and return a pileup object
+    
+    int prefilterSite(int totalDepth, int refDepth, char refBase); // Cheap filter on read counts and reference base, before bases are parsed. Returns the reason a site is filtered (1-4), or 0 if it is kept
+    
+    int prefilterRow(int numCells, boost::string_view row, ReferenceSite* reference = nullptr); // prefilterSite on the raw text of a pileup row, without parsing it into a Pileup. Returns 0 if the row is kept or cannot be scanned. If reference is given, it is filled in for rows that are filtered
+    
+    int countRefMatches(boost::string_view bases); // Counts the '.' and ',' in a column of pileup bases
+    
+    void splitFields(boost::string_view row, char delimiter, vector<boost::string_view>& fields); // Splits row at each delimiter into fields, which point into row. Scans with AVX2 or SSE2 where the CPU has them
     
-    vector<string> readPileup(int numCells, string filename); // Reads from pileup file, saving it as a vector of strings
+    boost::string_view trimView(boost::string_view text); // Removes leading and trailing whitespace from text
     
-    Pileup getPileup(int numCells, string& row); // Parses a row of pileup and return a pileup object
+    int parseInt(boost::string_view text); // Parses a decimal integer, like stoi
     
     array<array<array<double, 4>, 4>, 4> genGenotypePriors(double p); // Generates genotype priors matrix given probability p. priors[a][b][c] = p(^ab)(_c)
     
@@ -9,6 +9,10 @@
 #include "vcf.hpp"
 #include "wrdouble.hpp"
 
+#include <boost/algorithm/string.hpp>
+#include <htslib/tbx.h>
+#include <htslib/hts_endian.h>
+
 #include <stdio.h>
 #include <vector>
 #include <string>
@@ -16,12 +20,168 @@
 #include <chrono>
 #include <ctime>
 #include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 
-VCFDocument::VCFDocument(string filename) {
-    // Initialization function, sets up output file
-    outputFile.open(filename);
+static const size_t writeBatchSize = 1 << 20; // bytes of rows collected before writing to a plain file
+
+static void appendInt(string& out, long value) {
+    // appends value in decimal, as ostream writes it
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    unsigned long magnitude = value < 0 ? -(unsigned long) value : value;
+    do {
+        *--start = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) *--start = '-';
+    out.append(start, end - start);
+}
+
+static void appendDouble(string& out, double value) {
+    // appends value as ostream writes it with the default precision of 6, which is printf's %g. Whole numbers below 1e6, like PL, need no printf
+    if (fabs(value) < 1e6 && value == trunc(value) && !(value == 0 && signbit(value))) {
+        appendInt(out, (long) value);
+        return;
+    }
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%g", value);
+    out.append(text, length);
+}
+
+VCFDocument::VCFDocument(string filename, int ioThreads, int sparseGQ): VariantDocument(sparseGQ), outputFile(nullptr), filename(filename) {
+    // Initialization function, sets up output file. The filename - writes to stdout; rows are flushed as they are written
+    if (filename == "-") outputFile.rdbuf(cout.rdbuf());
+    else if (boost::ends_with(filename, ".gz")) {
+        // The header is collected in headerBuffer and rows arrive formatted; BGZF compresses both in blocks on ioThreads threads
+        bgzfFile = bgzf_open(filename.c_str(), "w");
+        if (!bgzfFile) throw runtime_error("Could not create output file " + filename);
+        if (ioThreads > 0 && bgzf_mt(bgzfFile, ioThreads, 256) < 0) throw runtime_error("Could not start compression threads");
+        outputFile.rdbuf(&headerBuffer);
+    } else {
+        file.open(filename);
+        if (!file) throw runtime_error("Could not create output file " + filename);
+        outputFile.rdbuf(file.rdbuf());
+    }
+}
+
+VCFDocument::~VCFDocument() {
+    // Best effort, as a destructor can not throw: errors are only thrown from an explicit close
+    try {
+        close();
+    } catch (exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+void VCFDocument::close() {
+    // Flushes the output. For BGZF output, the index is finished and saved as filename.tbi once all blocks are written
+    if (!bgzfFile) {
+        if (file.is_open()) flushPending();
+        outputFile.flush();
+        return;
+    }
+    // The handle and index are released before an error is thrown, so that a second close, as from the destructor, does nothing
+    bool failed = false;
+    try {
+        flushHeader();
+    } catch (runtime_error&) {
+        failed = true;
+    }
+    failed = failed || bgzf_flush(bgzfFile) < 0;
+    if (index) {
+        if (!failed) {
+            hts_idx_amend_last(index, bgzf_tell(bgzfFile));
+            if (hts_idx_finish(index, bgzf_tell(bgzfFile)) < 0 || hts_idx_save_as(index, filename.c_str(), nullptr, HTS_FMT_TBI) < 0) fprintf(stderr, "Could not write index of %s\n", filename.c_str());
+        }
+        hts_idx_destroy(index);
+        index = nullptr;
+    }
+    BGZF* closing = bgzfFile;
+    bgzfFile = nullptr;
+    if (bgzf_close(closing) < 0) failed = true; // frees the handle even when it fails
+    if (failed) throw runtime_error("Could not write to " + filename);
+}
+
+void VCFDocument::flushHeader() {
+    // Compresses the header text written to headerBuffer
+    string text = headerBuffer.str();
+    headerBuffer.str("");
+    if (text.size() && bgzf_write(bgzfFile, text.data(), text.size()) < 0) throw runtime_error("Could not write to " + filename);
+}
+
+void VCFDocument::flushPending() {
+    // Writes the batched rows to file in one go
+    if (!pending.size()) return;
+    if (!file.write(pending.data(), pending.size())) throw runtime_error("Could not write to " + filename);
+    pending.clear();
+}
+
+void VCFDocument::indexRow(const string& chromosome, int posID) {
+    // Adds the row just compressed to the index. Tabix needs rows sorted within each sequence and each sequence in one run
+    if (!index) return;
+    
+    if (chromosome != lastSeqID) {
+        if (find(seqIDs.begin(), seqIDs.end(), chromosome) != seqIDs.end()) posID = -1; // sequence seen before, so unsorted
+        else {
+            seqIDs.push_back(chromosome);
+            lastSeqID = chromosome;
+            lastPos = 0;
+        }
+    }
+    if (posID < lastPos) {
+        fprintf(stderr, "Rows of %s are not sorted, so it is not indexed\n", filename.c_str());
+        hts_idx_destroy(index);
+        index = nullptr;
+        return;
+    }
+    lastPos = posID;
+    int tid = hts_idx_tbi_name(index, seqIDs.size()-1, chromosome.c_str());
+    if (tid < 0 || bgzf_idx_push(bgzfFile, index, tid, posID-1, posID, bgzf_tell(bgzfFile), 1) < 0) throw runtime_error("Could not index " + filename);
+}
+
+vector<string> VariantDocument::defHeaderLines() const {
+    // header lines after fileformat and fileDate
+    vector<string> lines = {
+        "##source=MonoVar",
+        "##FILTER=<ID=LowQual,Description=\"Low quality\">",
+        "##INFO=<ID=AC,Number=A,Type=Integer,Description=\"Allele count in genotypes, for each ALT allele, in the same order as listed\">",
+        "##INFO=<ID=AF,Number=A,Type=Float,Description=\"Allele Frequency, for each ALT allele, in the same order as listed\">",
+        "##INFO=<ID=AN,Number=1,Type=Integer,Description=\"Total number of alleles in called genotypes\">",
+        "##INFO=<ID=BaseQRankSum,Number=1,Type=Float,Description=\"Z-score from Wilcoxon rank sum test of Alt Vs. Ref base qualities\">",
+        "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Approximate read depth; some reads may have been filtered\">",
+        "##INFO=<ID=QD,Number=1,Type=Float,Description=\"Variant Confidence/Quality by Depth\">",
+        "##INFO=<ID=SOR,Number=1,Type=Float,Description=\"Symmetric Odds Ratio of 2x2 contingency table to detect strand bias\">",
+        "##INFO=<ID=MPR,Number=1,Type=Float,Description=\"Log Odds Ratio of maximum value of probability of observing non-ref allele to the probability of observing zero non-ref allele\">",
+        "##INFO=<ID=PSARR,Number=1,Type=Float,Description=\"Ratio of per-sample Alt allele supporting reads to Ref allele supporting reads\">",
+        "##FORMAT=<ID=AD,Number=.,Type=Integer,Description=\"Allelic depths for the ref and alt alleles in the order listed\">",
+        "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Approximate read depth (reads with MQ=255 or with bad mates are filtered)\">",
+        "##FORMAT=<ID=GQ,Number=1,Type=Integer,Description=\"Genotype Quality\">",
+        "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">",
+        "##FORMAT=<ID=PL,Number=G,Type=Integer,Description=\"Normalized, Phred-scaled likelihoods for genotypes as defined in the VCF specification\">"
+    };
+    if (sparseGQ >= 0) {
+        // Sparse output describes its side field with the other INFO fields
+        auto firstFormat = find_if(lines.begin(), lines.end(), [](const string& line) { return boost::starts_with(line, "##FORMAT"); });
+        lines.insert(firstFormat, "##INFO=<ID=IC,Number=.,Type=Integer,Description=\"Cells whose FORMAT values are given, as 0-based sample numbers. Other cells are either without reads or reference calls with GQ>=" + to_string(sparseGQ) + "\">");
+    }
+    return lines;
+}
+
+int VariantDocument::genotypeQualities(array<wrdouble, 3> likelihoods, double quals[3]) {
+    // PL are the phred-scaled likelihoods relative to the most likely genotype; GQ is the smallest nonzero PL
+    for (int j = 0; j < 3; j++) quals[j] = likelihoods[j].phred();
+    double lowest = 1e9;
+    for (int j = 0; j < 3; j++) lowest = min(lowest, quals[j]);
+    for (int j = 0; j < 3; j++) quals[j] = round(quals[j]-lowest);
+    int secondLowest = 1e9;
+    for (int j = 0; j < 3; j++) if (quals[j]) secondLowest = min(secondLowest, int(quals[j]));
+    return secondLowest;
 }
 
 void VCFDocument::writeDefHeader() {
@@ -30,22 +190,7 @@ void VCFDocument::writeDefHeader() {
     auto time = chrono::system_clock::now();
     time_t time_c = chrono::system_clock::to_time_t(time);
     outputFile << "##fileDate=" << put_time(localtime(&time_c), "%F") << endl;
-    outputFile << "##source=MonoVar" << endl;
-    outputFile << "##FILTER=<ID=LowQual,Description=\"Low quality\">" << endl;
-    outputFile << "##INFO=<ID=AC,Number=A,Type=Integer,Description=\"Allele count in genotypes, for each ALT allele, in the same order as listed\">" << endl;
-    outputFile << "##INFO=<ID=AF,Number=A,Type=Float,Description=\"Allele Frequency, for each ALT allele, in the same order as listed\">" << endl;
-    outputFile << "##INFO=<ID=AN,Number=1,Type=Integer,Description=\"Total number of alleles in called genotypes\">" << endl;
-    outputFile << "##INFO=<ID=BaseQRankSum,Number=1,Type=Float,Description=\"Z-score from Wilcoxon rank sum test of Alt Vs. Ref base qualities\">" << endl;
-    outputFile << "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Approximate read depth; some reads may have been filtered\">" << endl;
-    outputFile << "##INFO=<ID=QD,Number=1,Type=Float,Description=\"Variant Confidence/Quality by Depth\">" << endl;
-    outputFile << "##INFO=<ID=SOR,Number=1,Type=Float,Description=\"Symmetric Odds Ratio of 2x2 contingency table to detect strand bias\">" << endl;
-    outputFile << "##INFO=<ID=MPR,Number=1,Type=Float,Description=\"Log Odds Ratio of maximum value of probability of observing non-ref allele to the probability of observing zero non-ref allele\">" << endl;
-    outputFile << "##INFO=<ID=PSARR,Number=1,Type=Float,Description=\"Ratio of per-sample Alt allele supporting reads to Ref allele supporting reads\">" << endl;
-    outputFile << "##FORMAT=<ID=AD,Number=.,Type=Integer,Description=\"Allelic depths for the ref and alt alleles in the order listed\">" << endl;
-    outputFile << "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Approximate read depth (reads with MQ=255 or with bad mates are filtered)\">" << endl;
-    outputFile << "##FORMAT=<ID=GQ,Number=1,Type=Integer,Description=\"Genotype Quality\">" << endl;
-    outputFile << "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">" << endl;
-    outputFile << "##FORMAT=<ID=PL,Number=G,Type=Integer,Description=\"Normalized, Phred-scaled likelihoods for genotypes as defined in the VCF specification\">" << endl;
+    for (string& line: defHeaderLines()) outputFile << line << endl;
 }
 
 void VCFDocument::writeHeaderInfo(string referenceFilename, vector<string> bamIDs) {
@@ -55,12 +200,41 @@ void VCFDocument::writeHeaderInfo(string referenceFilename, vector<string> bamID
         outputFile << "\t" << bam;
     }
     outputFile << endl;
+    
+    if (bgzfFile) {
+        // The index covers the rows after the header, and carries the tabix settings for vcf
+        flushHeader();
+        index = hts_idx_init(0, HTS_FMT_TBI, bgzf_tell(bgzfFile), 14, 5);
+        if (!index) throw runtime_error("Could not create index of " + filename);
+        uint8_t meta[28];
+        u32_to_le(TBX_VCF, meta); // preset
+        u32_to_le(1, meta+4); // sequence column
+        u32_to_le(2, meta+8); // start column
+        u32_to_le(0, meta+12); // end column
+        u32_to_le('#', meta+16); // comment character
+        u32_to_le(0, meta+20); // lines to skip
+        u32_to_le(0, meta+24); // length of sequence names, filled in by hts_idx_tbi_name
+        if (hts_idx_set_meta(index, sizeof(meta), meta, 1) < 0) throw runtime_error("Could not create index of " + filename);
+    }
 }
 
-void VCFDocument::writeRow(string chromosome, int posID, char ref, char alt, double quality, double wilcoxon, double qualityByDepth, double strandBias, double psarr, vector<int> genotypes, int depth, vector<pair<int, int>> cellDepths, vector<array<wrdouble, 3>> likelihoods) {
-    // writes a row, for mutation at a given site into file
+void VCFDocument::formatRow(VariantCall& call) const {
+    // formats a row, for mutation at a given site, into call.text. Runs on the worker threads, so the writer only copies text
     char baseMap[5] = {'A', 'C', 'T', 'G'};
-    outputFile << chromosome << "\t" << posID << "\t.\t" << baseMap[ref] << "\t" << baseMap[alt] << "\t" << quality << "\t.\t"; 
+    const vector<int>& genotypes = call.genotypes;
+    string& out = call.text;
+    out.clear();
+    out.reserve(256 + 32*genotypes.size());
+    out += call.chromosome;
+    out += '\t';
+    appendInt(out, call.posID);
+    out += "\t.\t";
+    out += baseMap[call.ref];
+    out += '\t';
+    out += baseMap[call.alt];
+    out += '\t';
+    appendDouble(out, call.quality);
+    out += "\t.\t";
     
     // compute alt count and stuff
     int altCount = 0, alleleCount = 0;
@@ -71,62 +245,100 @@ void VCFDocument::writeRow(string chromosome, int posID, char ref, char alt, dou
         }
     }
     double altFreq = double(altCount)/alleleCount;
-    outputFile << "AC=" << altCount << ";AF=" << altFreq << ";AN=" << alleleCount << ";";
+    out += "AC=";
+    appendInt(out, altCount);
+    out += ";AF=";
+    appendDouble(out, altFreq);
+    out += ";AN=";
+    appendInt(out, alleleCount);
     
     // wilcoxon
-    outputFile << "BaseQRankSum=" << wilcoxon << ";";
+    out += ";BaseQRankSum=";
+    appendDouble(out, call.wilcoxon);
     
     // depth
-    outputFile << "DP=" << depth << ";";
+    out += ";DP=";
+    appendInt(out, call.depth);
     
     // quality by depth
-    outputFile << "QD=" << qualityByDepth << ";";
+    out += ";QD=";
+    appendDouble(out, call.qualityByDepth);
     
     // strand bias
-    outputFile << "SOR=" << strandBias << ";";
-    
+    out += ";SOR=";
+    appendDouble(out, call.strandBias);
     
     // psarr
-    outputFile << "PSARR=" << psarr;
+    out += ";PSARR=";
+    appendDouble(out, call.psarr);
     
-    // Individual cell format
-    outputFile << "\tGT:AD:DP:GQ:PL";
+    // Individual cell format. The cells are formatted first, as sparse output lists the cells written in full in INFO
+    static thread_local string cells;
+    static thread_local vector<int> informative;
+    cells.clear();
+    informative.clear();
     int likelihoodsIndex = 0;
     for (int i = 0; i < genotypes.size(); i++) {
-        if (genotypes[i] == -1) outputFile << "\t./.";
-        else {
-            outputFile << "\t";
-            if (genotypes[i] == 0) outputFile << "0/0";
-            else if (genotypes[i] == 1) outputFile << "0/1";
-            else if (genotypes[i] == 2) outputFile << "1/1";
-            
-            outputFile << ":" << cellDepths[i].first << "," << cellDepths[i].second;
-            outputFile << ":" << cellDepths[i].first+cellDepths[i].second;
-            
-            double quals[3];
-            for (int j = 0; j < 3; j++) quals[j] = likelihoods[likelihoodsIndex][j].phred();
-            double lowest = 1e9;
-            for (double qual: quals) lowest = min(lowest, qual);
-            for (int j = 0; j < 3; j++) quals[j] = round(quals[j]-lowest);
-            int secondLowest = 1e9;
-            for (int j = 0; j < 3; j++) if (quals[j]) secondLowest = min(secondLowest, int(quals[j]));
-            
-            outputFile << ":" << secondLowest << ":";
-            for (int j = 0; j < 3; j++) {
-                if (j != 0) outputFile << ",";
-                outputFile << quals[j];
-            }
-            
-            likelihoodsIndex++;
+        if (genotypes[i] == -1) {
+            cells += sparseGQ >= 0 ? "\t." : "\t./.";
+            continue;
+        }
+        double quals[3];
+        int secondLowest = genotypeQualities(call.likelihoods[likelihoodsIndex++], quals);
+        
+        if (genotypes[i] == 0) cells += "\t0/0";
+        else if (genotypes[i] == 1) cells += "\t0/1";
+        else if (genotypes[i] == 2) cells += "\t1/1";
+        else cells += '\t';
+        if (collapsed(genotypes[i], secondLowest)) continue;
+        informative.push_back(i);
+        
+        const pair<int, int>& depths = call.cellDepths[i];
+        cells += ':';
+        appendInt(cells, depths.first);
+        cells += ',';
+        appendInt(cells, depths.second);
+        cells += ':';
+        appendInt(cells, depths.first+depths.second);
+        cells += ':';
+        appendInt(cells, secondLowest);
+        cells += ':';
+        for (int j = 0; j < 3; j++) {
+            if (j != 0) cells += ',';
+            appendDouble(cells, quals[j]);
         }
     }
     
+    if (sparseGQ >= 0 && informative.size()) {
+        out += ";IC=";
+        for (int j = 0; j < informative.size(); j++) {
+            if (j != 0) out += ',';
+            appendInt(out, informative[j]);
+        }
+    }
+    out += "\tGT:AD:DP:GQ:PL";
+    out += cells;
+    
     // Final genotype summary
-    outputFile << "\t<";
+    out += "\t<";
     for (int i: genotypes) {
-        if (i == -1) outputFile << "X";
-        else outputFile << i;
+        if (i == -1) out += 'X';
+        else appendInt(out, i);
+    }
+    out += ">\n";
+}
+
+void VCFDocument::writeRow(const VariantCall& call) {
+    // writes the row formatted by formatRow. Rows to a file are batched into large writes; stdout gets each row as soon as it is called
+    if (bgzfFile) {
+        // BGZF collects rows into blocks itself
+        if (bgzf_write(bgzfFile, call.text.data(), call.text.size()) < 0) throw runtime_error("Could not write to " + filename);
+        indexRow(call.chromosome, call.posID);
+    } else if (filename == "-") {
+        outputFile.write(call.text.data(), call.text.size());
+        outputFile.flush();
+    } else {
+        pending += call.text;
+        if (pending.size() >= writeBatchSize) flushPending();
     }
-    outputFile << ">";
-    outputFile << endl;
 }
@@ -16,17 +16,70 @@
 #include <string>
 #include <array>
 #include <fstream>
+#include <sstream>
+
+#include <htslib/bgzf.h>
+#include <htslib/hts.h>
 
 using namespace std;
 
-class VCFDocument {
+struct VariantCall {
+    // Everything written for a called site, so that calling and writing can happen on different threads
+    string chromosome;
+    int posID;
+    char ref, alt;
+    double quality, wilcoxon, qualityByDepth, strandBias, psarr;
+    vector<int> genotypes;
+    int depth;
+    vector<pair<int, int>> cellDepths;
+    vector<array<wrdouble, 3>> likelihoods;
+    string text; // the row as text, filled in by formatRow for formats that write text
+};
+
+class VariantDocument {
+    // Output of called variants, as text vcf (VCFDocument) or bcf (BCFDocument)
+protected:
+    int sparseGQ; // for sparse output, the GQ from which reference calls are written as a bare 0/0. -1 writes every cell in full
+    
+    vector<string> defHeaderLines() const; // ## lines describing the INFO and FORMAT fields, shared by all formats
+    bool collapsed(int genotype, int gq) const { return sparseGQ >= 0 && genotype == 0 && gq >= sparseGQ; } // whether a called cell is written without its FORMAT values
+public:
+    VariantDocument(int sparseGQ = -1): sparseGQ(sparseGQ) {}
+    static int genotypeQualities(array<wrdouble, 3> likelihoods, double quals[3]); // sets quals to the normalized, phred-scaled likelihoods (PL), and returns the genotype quality (GQ)
+    virtual ~VariantDocument() {}
+    virtual void writeDefHeader() = 0; // writes default header, containing date and format specs
+    virtual void writeHeaderInfo(string referenceFilename, vector<string> bamIDs) = 0; // writes specific info, like reference file, samples
+    virtual void formatRow(VariantCall& call) const {} // does the per-row work that needs no shared state. Called on the worker threads, before the call goes to writeRow
+    virtual void writeRow(const VariantCall& call) = 0; // writes a called site. Called on the writer thread only, in input order
+    virtual void close() = 0; // flushes the output
+};
+
+class VCFDocument: public VariantDocument {
 private:
-    ofstream outputFile;
+    ofstream file; // output file, unless writing to stdout or BGZF
+    ostream outputFile; // header output: writes to file, to stdout for the filename -, or to headerBuffer for BGZF output
+    string pending; // rows not yet written to file, which is written in large batches
+    
+    // BGZF output, for filenames ending in .gz
+    string filename;
+    BGZF* bgzfFile = nullptr; // compressed on its own threads
+    stringbuf headerBuffer; // header text not yet compressed
+    hts_idx_t* index = nullptr; // tabix index, built as rows are written. Dropped if rows come out of order
+    vector<string> seqIDs; // sequence names in the index, in order of first row
+    string lastSeqID; // sequence of the last indexed row
+    int lastPos = 0; // position of the last indexed row
+    
+    void flushHeader(); // compresses the header text in headerBuffer
+    void indexRow(const string& chromosome, int posID); // adds the row just compressed to the index
+    void flushPending(); // writes the batched rows to file
 public:
-    VCFDocument(string filename); // Initialization function, sets up output file
+    VCFDocument(string filename, int ioThreads = 2, int sparseGQ = -1); // Initialization function, sets up output file. A filename ending in .gz is written as BGZF, compressed on ioThreads threads, with a tabix index next to it. sparseGQ >= 0 selects sparse output
+    ~VCFDocument();
+    void close(); // flushes the output, and writes the index for BGZF output
     void writeDefHeader(); // writes default header of vcf file, containing date and format specs
     void writeHeaderInfo(string referenceFilename, vector<string> bamIDs); // writes specific info, like reference file, column headers
-    void writeRow(string chromosome, int posID, char ref, char alt, double quality, double wilcoxon, double qualityByDepth, double strandBias, double psarr, vector<int> genotypes, int depth, vector<pair<int, int>> cellDepths, vector<array<wrdouble, 3>> likelihoods); // writes a row, for mutation at a given site into file
+    void formatRow(VariantCall& call) const; // formats the row of call into call.text
+    void writeRow(const VariantCall& call); // writes the text of call into file
 };
 
 #endif /* vcf_hpp */
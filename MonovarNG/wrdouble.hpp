@@ -11,51 +11,148 @@
 
 #include <stdio.h>
 #include <iostream>
+#include <string>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 
 using namespace std;
 
+// Header-only, so that the operators inline into the likelihood and dp loops without link-time optimization
 struct wrdouble {
     
     // wrdouble = value * base^exp. Can never be negative
-    static double base;
-    static double invBase; // inverse of base
+    static constexpr double base = 18446744073709551616.0; // 2^64
+    static constexpr double invBase = 1/base; // inverse of base
+    static constexpr int zeroExponent = -1000000; // exponent of zero, this number is very small!
     
     double value; // 1 <= value < base
     int exponent;
     
-    wrdouble(); // default constructor
-    wrdouble(double value, int exponent); // constructor given value and exp
-    wrdouble(double n); // constructor from double
+    wrdouble() = default; // default constructor, uninitialized like a double
+    constexpr wrdouble(double value, int exponent): value(value), exponent(exponent) {} // constructor given value and exp
+    wrdouble(double n) { assign(n); } // constructor from double
     
-    operator double(); // casting to double
+    operator double() const; // casting to double, 0 if out of the range of doubles
     operator string() const; // casting to string
     
-    friend ostream& operator<<(ostream& out, const wrdouble& n); // printing conversion
+    friend ostream& operator<<(ostream& out, const wrdouble& n) {
+        // printing conversion
+        return out << string(n);
+    }
     
-    wrdouble& operator=(double n); // assignment of double
-    wrdouble& operator=(const wrdouble& n); // assignment of wrdouble
+    wrdouble& operator=(double n) {
+        // assignment of double
+        assign(n);
+        return *this;
+    }
+    wrdouble& operator=(const wrdouble& n) = default; // assignment of wrdouble
     
-    bool operator<(wrdouble& n); // comparator <
-    bool operator>(wrdouble& n); // comparator >
+    constexpr bool operator<(const wrdouble& n) const {
+        // comparator <
+        return exponent < n.exponent || (exponent == n.exponent && value < n.value);
+    }
+    constexpr bool operator>(const wrdouble& n) const {
+        // comparator >
+        return n < *this;
+    }
+    bool operator<(double n) const { return double(*this) < n; } // comparator < with double, compared as doubles
+    bool operator>(double n) const { return double(*this) > n; } // comparator > with double, compared as doubles
     
-    wrdouble operator*(const wrdouble& n) const; // multiplication
-    wrdouble operator/(const wrdouble& n) const; // division
-    wrdouble operator+(const wrdouble& n) const; // addition
+    constexpr wrdouble operator*(const wrdouble& n) const {
+        // multiplication
+        return carry(value * n.value, exponent + n.exponent);
+    }
+    constexpr wrdouble operator/(const wrdouble& n) const {
+        // division
+        return borrow(value / n.value, exponent - n.exponent);
+    }
+    constexpr wrdouble operator+(const wrdouble& n) const {
+        // addition. A term more than one exponent smaller is below the precision of the other and is dropped
+        return exponent > n.exponent+1 ? *this // if this >> n
+            : exponent + 1 < n.exponent ? n // if this << n
+            : exponent == n.exponent ? carry(value + n.value, exponent)
+            : exponent == n.exponent + 1 ? carry(value + n.value*invBase, exponent) // this > n, not by too much
+            : carry(value*invBase + n.value, n.exponent); // this < n, not by too much
+    }
     
-    wrdouble operator*(double n) const; // multiplication with double
-    wrdouble operator/(double n) const; // division with double
-    wrdouble operator+(double n) const; // addition with double
+    wrdouble operator*(double n) const { return (*this) * wrdouble(n); } // multiplication with double
+    wrdouble operator/(double n) const { return (*this) / wrdouble(n); } // division with double
+    wrdouble operator+(double n) const { return (*this) + wrdouble(n); } // addition with double
     
-    wrdouble& operator*=(const wrdouble& n); // multiplication and assignment
-    wrdouble& operator/=(const wrdouble& n); // division and assignment
-    wrdouble& operator+=(const wrdouble& n); // addition and assignment
+    wrdouble& operator*=(const wrdouble& n) { return *this = *this * n; } // multiplication and assignment
+    wrdouble& operator/=(const wrdouble& n) { return *this = *this / n; } // division and assignment
+    wrdouble& operator+=(const wrdouble& n) { return *this = *this + n; } // addition and assignment
     
-    wrdouble& operator*=(double n); // multiplication and assignment with double
-    wrdouble& operator/=(double n); // division and assignment with double
-    wrdouble& operator+=(double n); // addition and assignment with double
+    wrdouble& operator*=(double n) { return (*this) *= wrdouble(n); } // multiplication and assignment with double
+    wrdouble& operator/=(double n) { return (*this) /= wrdouble(n); } // division and assignment with double
+    wrdouble& operator+=(double n) { return (*this) += wrdouble(n); } // addition and assignment with double
     
-    double phred(); // returns the phred value of the wrdouble
+    double phred() const {
+        // returns the phred value of the wrdouble
+        return -10.0*(log10(value) + 64.0*exponent*log10(2.0));
+    }
+    
+private:
+    static constexpr wrdouble carry(double value, int exponent) {
+        // result of a product or sum of values in [1, base), which is below base^2
+        return value >= base ? wrdouble(value*invBase, exponent+1) : wrdouble(value, exponent);
+    }
+    static constexpr wrdouble borrow(double value, int exponent) {
+        // result of a quotient of values in [1, base), which is above 1/base
+        return value < 1 && value != 0 ? wrdouble(value*base, exponent-1) : wrdouble(value, exponent);
+    }
+    static double powerOfTwo(int k) {
+        // 2^k for a normal double, built from its exponent bits
+        uint64_t bits = uint64_t(k + 1023) << 52;
+        double n;
+        memcpy(&n, &bits, 8);
+        return n;
+    }
+    void assign(double n);
 };
 
+inline void wrdouble::assign(double n) {
+    // Splits n into value and exponent. For normal doubles the binary exponent gives the exponent directly, and value is n with its exponent bits replaced
+    if (n == 0) { // if zero
+        value = 0;
+        exponent = zeroExponent;
+        return;
+    }
+    uint64_t bits;
+    memcpy(&bits, &n, 8);
+    int biased = (bits >> 52) & 0x7ff;
+    if (biased == 0 || biased == 0x7ff) {
+        // subnormal, infinite or nan, which never occur in the likelihoods
+        exponent = 0;
+        value = n;
+        if (biased == 0x7ff) return;
+        while (value < 1) {
+            exponent--;
+            value *= base;
+        }
+        return;
+    }
+    exponent = (biased - 1023) >> 6; // floor of the binary exponent over 64
+    bits += uint64_t(-64*exponent) << 52; // exact, as value keeps the mantissa
+    memcpy(&value, &bits, 8);
+}
+
+inline wrdouble::operator double() const {
+    // casting to double. Splitting the scale keeps both factors normal, so the product is rounded once as value * base^exponent
+    if (exponent < -16 || exponent > 15) return 0; // if underflow or overflow
+    double half = powerOfTwo(32*exponent);
+    return value * half * half;
+}
+
+inline wrdouble::operator string() const {
+    // casting to string
+    if (value == 0) return "0";
+    double logged = log10(value) + log10(2) * 64 * exponent;
+    double val = pow(double(10), logged-floor(logged));
+    int exp = floor(logged);
+    if (abs(exp) <= 5) return to_string(val*pow(10, exp));
+    else return to_string(val) + "e" + to_string(exp);
+}
+
 #endif /* wrdouble_hpp */